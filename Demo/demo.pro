@@ -18,5 +18,5 @@ CONFIG += $$DEBUGRELEASE
 CONFIG += console
 
 # Input
-HEADERS += src\MainWindow.h src\ParseScenario.h  src\ViewAgent.h src\PedSimulation.h 
-SOURCES += src\main.cpp src\MainWindow.cpp src\ParseScenario.cpp src\ViewAgent.cpp src\PedSimulation.cpp
\ No newline at end of file
+HEADERS += src\MainWindow.h src\ParseScenario.h  src\ViewAgent.h src\PedSimulation.h src\Snapshot.h src\TripleBuffer.h src\AllocationCounter.h src\AutoTuner.h src\HostInfo.h src\BenchmarkStore.h src\SocketCompat.h src\MetricsServer.h src\FrameServer.h src\ModelOptions.h 
+SOURCES += src\main.cpp src\MainWindow.cpp src\ParseScenario.cpp src\ViewAgent.cpp src\PedSimulation.cpp src\AllocationCounter.cpp src\AutoTuner.cpp src\HostInfo.cpp src\BenchmarkStore.cpp src\MetricsServer.cpp src\FrameServer.cpp src\ModelOptions.cpp
\ No newline at end of file
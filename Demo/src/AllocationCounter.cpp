@@ -0,0 +1,73 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// Replaces the global operator new and delete to count allocations.
+//
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long long> allocations(0);
+
+long long AllocationCounter::count()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+void *operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	void *memory = std::malloc(size == 0 ? 1 : size);
+	if (memory == NULL) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void *operator new[](std::size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	return std::malloc(size == 0 ? 1 : size);
+}
+
+void *operator new[](std::size_t size, const std::nothrow_t &tag) noexcept
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void *memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void *memory) noexcept
+{
+	std::free(memory);
+}
+
+// The sized forms are replaced too, so that no delete bypasses ours
+void operator delete(void *memory, std::size_t) noexcept
+{
+	operator delete(memory);
+}
+
+void operator delete[](void *memory, std::size_t) noexcept
+{
+	operator delete[](memory);
+}
+
+void operator delete(void *memory, const std::nothrow_t&) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void *memory, const std::nothrow_t&) noexcept
+{
+	std::free(memory);
+}
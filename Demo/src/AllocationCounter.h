@@ -0,0 +1,22 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// AllocationCounter counts the calls to the global operator new
+// of the whole program, library included, on all threads. The
+// --alloc-check mode uses it to verify that a warmed-up tick
+// never allocates.
+//
+// Only the plain operator new is counted: malloc is not, and
+// neither is the debug operator new that debug builds use for
+// the leak check. Run the check with a release build.
+//
+#ifndef _allocation_counter_h_
+#define _allocation_counter_h_
+
+class AllocationCounter {
+public:
+	// Number of allocations since the program started
+	static long long count();
+};
+
+#endif
@@ -0,0 +1,279 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+
+#include "AutoTuner.h"
+#include "ParseScenario.h"
+#include "HostInfo.h"
+#include <QFile>
+#include <QTextStream>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <set>
+#include <algorithm>
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+// Ticks run before timing starts, and ticks timed per candidate
+#define TUNE_WARMUP_TICKS 5
+#define TUNE_TIMED_TICKS 30
+
+// Walking backends may round differently, so only this share of the
+// agents has to be within one cell of the reference
+#define TUNE_AGREEMENT 0.99
+
+// Collision backends break ties in a different order, so their crowds
+// drift apart a little: this share of the agents has to be within
+// TUNE_COLLISION_CELLS cells of a reference agent, the crowd's mean
+// displacement from the start may differ by TUNE_DISPLACEMENT_CELLS
+// per agent, and the heatmap's sum by a TUNE_HEAT_TOLERANCE share
+#define TUNE_COLLISION_AGREEMENT 0.9
+#define TUNE_COLLISION_CELLS 2
+#define TUNE_DISPLACEMENT_CELLS 1.0
+#define TUNE_HEAT_TOLERANCE 0.05
+
+AutoTuner::AutoTuner(const QString &scenefile, const QString &cachefile) : scenefile(scenefile), cachefile(cachefile)
+{
+}
+
+const char *AutoTuner::name(Ped::IMPLEMENTATION implementation)
+{
+	static const char *names[] = {
+		"CUDA", "VECTOR", "OMP", "PTHREAD", "SEQ", "VECTOROMP", "REGION", "SEQCOLLISION",
+		"SEQCOLLISIONOMP", "DYNAMICREGION", "CPU_GPU", "HEATMAP_SEQ", "INTSTEP", "FLOWFIELD"
+	};
+	if ((int)implementation < 0 || (int)implementation >= (int)(sizeof(names) / sizeof(names[0]))) {
+		return "UNKNOWN";
+	}
+	return names[implementation];
+}
+
+std::vector<AutoTuner::Choice> AutoTuner::candidates(Family family) const
+{
+	// 1, 2, 4, ... threads, up to the number of hardware threads
+	std::vector<int> threadCounts;
+	const int hardwareThreads = std::max((int)std::thread::hardware_concurrency(), 1);
+	for (int threads = 1; threads < hardwareThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(hardwareThreads);
+
+	// The first candidate is the family's reference
+	std::vector<Choice> result;
+	std::vector<Ped::IMPLEMENTATION> parallel;
+	if (family == WALKING) {
+		Choice seq = { Ped::SEQ, 1 };
+		Choice vector = { Ped::VECTOR, 1 };
+		result.push_back(seq);
+		result.push_back(vector);
+		parallel.push_back(Ped::OMP);
+		parallel.push_back(Ped::PTHREAD);
+		parallel.push_back(Ped::VECTOROMP);
+	}
+	else if (family == COLLISION) {
+		// SEQCOLLISIONOMP is left out: its agents race for cells
+		Choice seq = { Ped::SEQCOLLISION, 1 };
+		result.push_back(seq);
+		parallel.push_back(Ped::REGION);
+	}
+	else {
+		parallel.push_back(Ped::HEATMAP_SEQ);
+	}
+
+	for (int i = 0; i < parallel.size(); i++) {
+		for (int t = 0; t < threadCounts.size(); t++) {
+			Choice choice = { parallel[i], threadCounts[t] };
+			result.push_back(choice);
+		}
+	}
+	return result;
+}
+
+AutoTuner::Result AutoTuner::calibrate(const Choice &candidate)
+{
+	Ped::Model model;
+	ParseScenario parser(scenefile, model);
+	model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), candidate.implementation);
+	model.setNumThreads(candidate.threads);
+
+	// The sums of the positions, which do not depend on the order of the agents
+	const std::vector<Ped::Tagent*> &agents = model.getAgents();
+	long long startX = 0, startY = 0;
+	for (int i = 0; i < agents.size(); i++) {
+		if (agents[i]->isActive()) {
+			startX += agents[i]->getX();
+			startY += agents[i]->getY();
+		}
+	}
+
+	for (int tick = 0; tick < TUNE_WARMUP_TICKS; tick++) {
+		model.tick();
+	}
+	auto start = std::chrono::steady_clock::now();
+	for (int tick = 0; tick < TUNE_TIMED_TICKS; tick++) {
+		model.tick();
+	}
+	std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+
+	Result result;
+	result.seconds = duration.count();
+	long long endX = 0, endY = 0;
+	for (int i = 0; i < agents.size(); i++) {
+		if (agents[i]->isActive()) {
+			result.positions.push_back(std::make_pair(agents[i]->getX(), agents[i]->getY()));
+			endX += agents[i]->getX();
+			endY += agents[i]->getY();
+		}
+	}
+	result.displacementX = (double)(endX - startX);
+	result.displacementY = (double)(endY - startY);
+
+	result.heat = 0;
+	int const * const *heatmap = model.getHeatmap();
+	for (int y = 0; y < model.getHeatmapSize(); y++) {
+		for (int x = 0; x < model.getHeatmapSize(); x++) {
+			result.heat += heatmap[y][x];
+		}
+	}
+	return result;
+}
+
+// Share of the candidate's agents that stand within distance cells of
+// some agent of the reference
+static double closeShare(const std::vector<std::pair<int, int> > &reference, const std::vector<std::pair<int, int> > &candidate, int distance)
+{
+	if (candidate.empty()) {
+		return 1.0;
+	}
+	std::set<std::pair<int, int> > referenceCells(reference.begin(), reference.end());
+	int close = 0;
+	for (int i = 0; i < candidate.size(); i++) {
+		bool found = false;
+		for (int dx = -distance; dx <= distance && !found; dx++) {
+			for (int dy = -distance; dy <= distance && !found; dy++) {
+				found = referenceCells.count(std::make_pair(candidate[i].first + dx, candidate[i].second + dy)) > 0;
+			}
+		}
+		close += found;
+	}
+	return (double)close / candidate.size();
+}
+
+// Agents are compared as a crowd, not one by one: cleanup() may have
+// reordered the agents of one model and not those of the other
+bool AutoTuner::agrees(Family family, const Result &reference, const Result &candidate) const
+{
+	if (candidate.positions.size() != reference.positions.size()) {
+		return false;
+	}
+
+	if (family == WALKING) {
+		return closeShare(reference.positions, candidate.positions, 1) >= TUNE_AGREEMENT;
+	}
+
+	// No two agents may ever share a cell
+	std::set<std::pair<int, int> > cells(candidate.positions.begin(), candidate.positions.end());
+	if (cells.size() != candidate.positions.size()) {
+		return false;
+	}
+
+	// The collision backends move agents in different orders, so the
+	// crowds only agree within the tolerances above
+	if (closeShare(reference.positions, candidate.positions, TUNE_COLLISION_CELLS) < TUNE_COLLISION_AGREEMENT) {
+		return false;
+	}
+	const double driftX = candidate.displacementX - reference.displacementX;
+	const double driftY = candidate.displacementY - reference.displacementY;
+	if (std::sqrt(driftX * driftX + driftY * driftY) > TUNE_DISPLACEMENT_CELLS * candidate.positions.size()) {
+		return false;
+	}
+	return family != HEATMAP || std::abs(candidate.heat - reference.heat) <= TUNE_HEAT_TOLERANCE * reference.heat;
+}
+
+AutoTuner::Choice AutoTuner::choose(Family family)
+{
+	const unsigned long long key = fingerprint(family);
+	Choice best;
+	if (loadCached(key, best)) {
+		return best;
+	}
+
+	std::vector<Choice> all = candidates(family);
+	Result reference;
+	double bestSeconds = 0;
+	for (int i = 0; i < all.size(); i++) {
+		Result result = calibrate(all[i]);
+		if (i == 0) {
+			reference = result;
+		}
+		else if (!agrees(family, reference, result)) {
+			std::cout << "Auto-tuner: " << name(all[i].implementation) << " with " << all[i].threads << " threads disagrees with "
+				<< name(all[0].implementation) << ", skipped" << std::endl;
+			continue;
+		}
+
+		std::cout << "Auto-tuner: " << name(all[i].implementation) << " with " << all[i].threads << " threads: "
+			<< result.seconds * 1000.0 / TUNE_TIMED_TICKS << " ms per tick" << std::endl;
+		if (i == 0 || result.seconds < bestSeconds) {
+			best = all[i];
+			bestSeconds = result.seconds;
+		}
+	}
+
+	storeCached(key, best);
+	return best;
+}
+
+unsigned long long AutoTuner::fingerprint(Family family) const
+{
+	unsigned long long hash = HostInfo::scenarioHash(scenefile);
+	unsigned long long host = HostInfo::hostHash();
+	hash = HostInfo::fnv1a(hash, (const char *)&host, sizeof(host));
+	int familyId = family;
+	return HostInfo::fnv1a(hash, (const char *)&familyId, sizeof(familyId));
+}
+
+// One line per choice: the key in hex, the implementation's number, the
+// thread count, and the implementation's name for the reader
+bool AutoTuner::loadCached(unsigned long long key, Choice &choice) const
+{
+	QFile file(cachefile);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		return false;
+	}
+	QTextStream in(&file);
+	const QString hexKey = QString::number(key, 16);
+	while (!in.atEnd()) {
+		QStringList fields = in.readLine().split(' ', QString::SkipEmptyParts);
+		if (fields.size() >= 3 && fields[0] == hexKey) {
+			int implementation = fields[1].toInt();
+			if (implementation < Ped::CUDA || implementation > Ped::FLOWFIELD) {
+				return false;
+			}
+			choice.implementation = (Ped::IMPLEMENTATION)implementation;
+			choice.threads = fields[2].toInt();
+			return true;
+		}
+	}
+	return false;
+}
+
+void AutoTuner::storeCached(unsigned long long key, const Choice &choice) const
+{
+	QFile file(cachefile);
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+		std::cerr << "Auto-tuner: cannot write " << cachefile.toStdString() << std::endl;
+		return;
+	}
+	QTextStream out(&file);
+	out << QString::number(key, 16) << ' ' << (int)choice.implementation << ' ' << choice.threads << ' ' << name(choice.implementation) << '\n';
+}
@@ -0,0 +1,79 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// AutoTuner picks the fastest backend and thread count for a
+// scenario. Each candidate runs a short calibration on its own
+// freshly set up copy of the scenario. Candidates whose agents end
+// up disagreeing with the family's reference backend are dropped,
+// and the fastest of the rest wins.
+//
+// Choices are cached in a text file, keyed by a hash of the
+// scenario file and the host CPU, so only the first run on a
+// machine pays for the calibration.
+//
+#ifndef _auto_tuner_h_
+#define _auto_tuner_h_
+
+#include "ped_model.h"
+#include <QString>
+#include <vector>
+#include <utility>
+
+class AutoTuner {
+public:
+	// Backends that simulate the same thing and may replace each other
+	enum Family {
+		// Agents walk straight to their desired position
+		WALKING,
+		// Agents avoid each other
+		COLLISION,
+		// Agents avoid each other and the heatmap is updated on the CPU
+		HEATMAP
+	};
+
+	struct Choice {
+		Ped::IMPLEMENTATION implementation;
+		int threads;
+	};
+
+	AutoTuner(const QString &scenefile, const QString &cachefile = "autotune.cache");
+
+	// The cached choice for this scenario and host, or else the result
+	// of a fresh calibration, which is then cached
+	Choice choose(Family family);
+
+	static const char *name(Ped::IMPLEMENTATION implementation);
+
+private:
+	struct Result {
+		// Positions of the active agents after the calibration
+		std::vector<std::pair<int, int> > positions;
+
+		// How far the sum of the positions moved since setup, and the
+		// sum of the heatmap, after the calibration
+		double displacementX;
+		double displacementY;
+		double heat;
+
+		double seconds;
+	};
+
+	// Sets the scenario up for one candidate and runs the calibration
+	Result calibrate(const Choice &candidate);
+
+	// True if a candidate's agents ended up close enough to the reference's
+	bool agrees(Family family, const Result &reference, const Result &candidate) const;
+
+	std::vector<Choice> candidates(Family family) const;
+
+	// FNV-1a hash of the scenario file, the host CPU and the family
+	unsigned long long fingerprint(Family family) const;
+
+	bool loadCached(unsigned long long key, Choice &choice) const;
+	void storeCached(unsigned long long key, const Choice &choice) const;
+
+	QString scenefile;
+	QString cachefile;
+};
+
+#endif
@@ -0,0 +1,317 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+
+#include "BenchmarkStore.h"
+#include "AutoTuner.h"
+#include "HostInfo.h"
+#include "ParseScenario.h"
+#include <QFile>
+#include <QTextStream>
+#include <QStringList>
+#include <chrono>
+#include <ctime>
+#include <thread>
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+// Ticks run on every trial before timing starts
+#define BENCH_WARMUP_TICKS 10
+
+// A slowdown is a regression if Welch's t-test gives it a p-value
+// below BENCH_SIGNIFICANCE and it is at least BENCH_MIN_CHANGE of the
+// baseline's ticks per second
+#define BENCH_SIGNIFICANCE 0.05
+#define BENCH_MIN_CHANGE 0.01
+
+#define BENCH_HEADER "time,kind,backend,threads,scenario,host,cpu,hardware_threads,trial,ticks_per_second,movement_ms,heatmap_ms," \
+	"movement_cycles,movement_instructions,movement_llc_misses,movement_branch_misses," \
+	"heatmap_cycles,heatmap_instructions,heatmap_llc_misses,heatmap_branch_misses,options"
+
+// Columns of the results file. The options came last; older rows
+// without them never match a baseline.
+enum { COL_TIME, COL_KIND, COL_BACKEND, COL_THREADS, COL_SCENARIO, COL_HOST, COL_TICKS_PER_SECOND = 9, COL_OPTIONS = 20, COL_COUNT = 21 };
+
+static double median(std::vector<double> &values)
+{
+	if (values.empty()) {
+		return -1;
+	}
+	std::sort(values.begin(), values.end());
+	const size_t middle = values.size() / 2;
+	return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+static void meanAndVariance(const std::vector<double> &values, double &mean, double &variance)
+{
+	mean = 0;
+	for (size_t i = 0; i < values.size(); i++) {
+		mean += values[i];
+	}
+	mean /= values.size();
+
+	variance = 0;
+	for (size_t i = 0; i < values.size(); i++) {
+		variance += (values[i] - mean) * (values[i] - mean);
+	}
+	variance /= values.size() - 1;
+}
+
+// Continued fraction of the regularized incomplete beta function,
+// evaluated with the modified Lentz method
+static double betaContinuedFraction(double a, double b, double x)
+{
+	const double tiny = 1e-300;
+	double c = 1;
+	double d = 1 - (a + b) * x / (a + 1);
+	d = 1 / (fabs(d) < tiny ? tiny : d);
+	double h = d;
+	for (int m = 1; m <= 300; m++) {
+		// Even step
+		double term = m * (b - m) * x / ((a + 2 * m - 1) * (a + 2 * m));
+		d = 1 + term * d;
+		d = 1 / (fabs(d) < tiny ? tiny : d);
+		c = 1 + term / c;
+		c = fabs(c) < tiny ? tiny : c;
+		h *= d * c;
+
+		// Odd step
+		term = -(a + m) * (a + b + m) * x / ((a + 2 * m) * (a + 2 * m + 1));
+		d = 1 + term * d;
+		d = 1 / (fabs(d) < tiny ? tiny : d);
+		c = 1 + term / c;
+		c = fabs(c) < tiny ? tiny : c;
+		const double delta = d * c;
+		h *= delta;
+		if (fabs(delta - 1) < 1e-12) {
+			break;
+		}
+	}
+	return h;
+}
+
+// Regularized incomplete beta function I_x(a, b)
+static double incompleteBeta(double a, double b, double x)
+{
+	if (x <= 0) {
+		return 0;
+	}
+	if (x >= 1) {
+		return 1;
+	}
+	const double front = exp(lgamma(a + b) - lgamma(a) - lgamma(b) + a * log(x) + b * log(1 - x));
+	if (x < (a + 1) / (a + b + 2)) {
+		return front * betaContinuedFraction(a, b, x) / a;
+	}
+	return 1 - front * betaContinuedFraction(b, a, 1 - x) / b;
+}
+
+// Two-sided p-value of Welch's t-test for a difference in the means
+// of two samples with possibly different variances
+static double welchPValue(const std::vector<double> &a, const std::vector<double> &b)
+{
+	double meanA, varianceA, meanB, varianceB;
+	meanAndVariance(a, meanA, varianceA);
+	meanAndVariance(b, meanB, varianceB);
+
+	const double errorA = varianceA / a.size();
+	const double errorB = varianceB / b.size();
+	if (errorA + errorB == 0) {
+		return meanA == meanB ? 1 : 0;
+	}
+	const double t = (meanA - meanB) / sqrt(errorA + errorB);
+
+	// Welch-Satterthwaite degrees of freedom
+	const double df = (errorA + errorB) * (errorA + errorB) /
+		(errorA * errorA / (a.size() - 1) + errorB * errorB / (b.size() - 1));
+	return incompleteBeta(df / 2, 0.5, df / (df + t * t));
+}
+
+BenchmarkStore::BenchmarkStore(const QString &scenefile, const QString &resultfile) : scenefile(scenefile), resultfile(resultfile)
+{
+	scenario = HostInfo::scenarioHash(scenefile);
+	host = HostInfo::hostHash();
+}
+
+BenchmarkStore::Run BenchmarkStore::measure(Ped::IMPLEMENTATION implementation, int threads, const ModelOptions &options, int trials, int ticks, bool counters) const
+{
+	Run run;
+	run.implementation = implementation;
+	run.threads = threads;
+	run.options = options.key(implementation);
+
+	std::vector<double> stageSeconds[Ped::Model::STAGE_COUNT];
+	double stageTotals[Ped::Model::STAGE_COUNT][Ped::Tperfcounters::COUNTER_COUNT] = { { 0 } };
+	long long countedTicks[Ped::Model::STAGE_COUNT] = { 0 };
+	for (int trial = 0; trial < trials; trial++) {
+		Ped::Model model;
+		ParseScenario parser(scenefile, model);
+		model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation);
+		model.setNumThreads(threads);
+		options.apply(model, implementation);
+		model.setStageTiming(true);
+		model.setStageCounting(counters);
+
+		for (int tick = 0; tick < BENCH_WARMUP_TICKS; tick++) {
+			model.tick();
+		}
+		auto start = std::chrono::steady_clock::now();
+		for (int tick = 0; tick < ticks; tick++) {
+			model.tick();
+			for (int stage = 0; stage < Ped::Model::STAGE_COUNT; stage++) {
+				const double seconds = model.getStageSeconds((Ped::Model::STAGE)stage);
+				if (seconds < 0) {
+					continue;
+				}
+				stageSeconds[stage].push_back(seconds);
+				for (int counter = 0; counter < Ped::Tperfcounters::COUNTER_COUNT; counter++) {
+					stageTotals[stage][counter] += model.getStageCount((Ped::Model::STAGE)stage, (Ped::Tperfcounters::COUNTER)counter);
+				}
+				countedTicks[stage]++;
+			}
+		}
+		std::chrono::duration<double> duration = std::chrono::steady_clock::now() - start;
+		run.ticksPerSecond.push_back(ticks / duration.count());
+
+		std::cout << "Trial " << trial + 1 << "/" << trials << ": " << run.ticksPerSecond.back() << " ticks per second" << std::endl;
+	}
+
+	static const char *stageNames[] = { "movement", "heatmap" };
+	for (int stage = 0; stage < Ped::Model::STAGE_COUNT; stage++) {
+		run.stageMedians[stage] = median(stageSeconds[stage]);
+		for (int counter = 0; counter < Ped::Tperfcounters::COUNTER_COUNT; counter++) {
+			const bool counted = counters && countedTicks[stage] > 0 && Ped::Tperfcounters::available((Ped::Tperfcounters::COUNTER)counter);
+			run.stageCounts[stage][counter] = counted ? stageTotals[stage][counter] / countedTicks[stage] : -1;
+		}
+		if (run.stageMedians[stage] < 0) {
+			continue;
+		}
+
+		std::cout << "Stage " << stageNames[stage] << ": median " << run.stageMedians[stage] * 1000.0 << " ms";
+		for (int counter = 0; counter < Ped::Tperfcounters::COUNTER_COUNT; counter++) {
+			if (run.stageCounts[stage][counter] >= 0) {
+				std::cout << ", " << run.stageCounts[stage][counter] << " " << Ped::Tperfcounters::name((Ped::Tperfcounters::COUNTER)counter);
+			}
+		}
+		const double cycles = run.stageCounts[stage][Ped::Tperfcounters::CYCLES];
+		const double instructions = run.stageCounts[stage][Ped::Tperfcounters::INSTRUCTIONS];
+		if (cycles > 0 && instructions >= 0) {
+			std::cout << ", " << instructions / cycles << " instructions per cycle";
+		}
+		std::cout << (counters ? " per tick" : "") << std::endl;
+	}
+	if (counters && !Ped::Tperfcounters::available(Ped::Tperfcounters::CYCLES)) {
+		std::cout << "Hardware counters unavailable; only timings reported" << std::endl;
+	}
+	return run;
+}
+
+void BenchmarkStore::store(const Run &run, bool baseline) const
+{
+	QFile file(resultfile);
+	const bool empty = !file.exists() || file.size() == 0;
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) {
+		std::cerr << "Benchmark: cannot write " << resultfile.toStdString() << std::endl;
+		return;
+	}
+	QTextStream out(&file);
+	if (empty) {
+		out << BENCH_HEADER << '\n';
+	}
+
+	// The CPU name is for the reader; commas would split it into columns
+	QString cpu = QString::fromStdString(HostInfo::cpuName());
+	cpu.replace(',', ' ');
+
+	const long long now = (long long)time(NULL);
+	for (size_t trial = 0; trial < run.ticksPerSecond.size(); trial++) {
+		out << now << ',' << (baseline ? "baseline" : "run") << ',' << AutoTuner::name(run.implementation) << ',' << run.threads << ','
+			<< QString::number(scenario, 16) << ',' << QString::number(host, 16) << ',' << cpu << ',' << std::thread::hardware_concurrency() << ','
+			<< trial << ',' << run.ticksPerSecond[trial];
+		for (int stage = 0; stage < Ped::Model::STAGE_COUNT; stage++) {
+			out << ',';
+			if (run.stageMedians[stage] >= 0) {
+				out << run.stageMedians[stage] * 1000.0;
+			}
+		}
+		for (int stage = 0; stage < Ped::Model::STAGE_COUNT; stage++) {
+			for (int counter = 0; counter < Ped::Tperfcounters::COUNTER_COUNT; counter++) {
+				out << ',';
+				if (run.stageCounts[stage][counter] >= 0) {
+					out << QString::number(run.stageCounts[stage][counter], 'f', 0);
+				}
+			}
+		}
+		out << ',' << run.options << '\n';
+	}
+}
+
+std::vector<double> BenchmarkStore::loadBaseline(const Run &run) const
+{
+	std::vector<double> ticksPerSecond;
+	QFile file(resultfile);
+	if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+		return ticksPerSecond;
+	}
+
+	const QString backend = AutoTuner::name(run.implementation);
+	const QString threads = QString::number(run.threads);
+	const QString scenarioKey = QString::number(scenario, 16);
+	const QString hostKey = QString::number(host, 16);
+
+	// Rows of one stored run share its time, and later runs come later
+	// in the file, so the newest baseline is the last time seen
+	QString newest;
+	QTextStream in(&file);
+	while (!in.atEnd()) {
+		QStringList fields = in.readLine().split(',');
+		if (fields.size() < COL_COUNT || fields[COL_KIND] != "baseline" || fields[COL_BACKEND] != backend ||
+			fields[COL_THREADS] != threads || fields[COL_SCENARIO] != scenarioKey || fields[COL_HOST] != hostKey || fields[COL_OPTIONS] != run.options) {
+			continue;
+		}
+		if (fields[COL_TIME] != newest) {
+			newest = fields[COL_TIME];
+			ticksPerSecond.clear();
+		}
+		ticksPerSecond.push_back(fields[COL_TICKS_PER_SECOND].toDouble());
+	}
+	return ticksPerSecond;
+}
+
+bool BenchmarkStore::compare(const Run &run) const
+{
+	std::vector<double> baseline = loadBaseline(run);
+	if (baseline.size() < 2 || run.ticksPerSecond.size() < 2) {
+		std::cout << "Benchmark: no baseline with at least two trials for " << AutoTuner::name(run.implementation)
+			<< " with " << run.threads << " threads and " << run.options.toStdString() << "; store one with --save-baseline" << std::endl;
+		return true;
+	}
+
+	double baselineMean, baselineVariance, runMean, runVariance;
+	meanAndVariance(baseline, baselineMean, baselineVariance);
+	meanAndVariance(run.ticksPerSecond, runMean, runVariance);
+	const double change = (runMean - baselineMean) / baselineMean;
+	const double p = welchPValue(run.ticksPerSecond, baseline);
+
+	std::cout << "Benchmark: " << AutoTuner::name(run.implementation) << " with " << run.threads << " threads and " << run.options.toStdString() << ": "
+		<< runMean << " ticks per second (sd " << sqrt(runVariance) << ", " << run.ticksPerSecond.size() << " trials), baseline "
+		<< baselineMean << " (sd " << sqrt(baselineVariance) << ", " << baseline.size() << " trials), "
+		<< (change >= 0 ? "+" : "") << change * 100.0 << "%, p = " << p << std::endl;
+
+	const bool significant = p < BENCH_SIGNIFICANCE && fabs(change) >= BENCH_MIN_CHANGE;
+	if (significant && change < 0) {
+		std::cout << "Benchmark: REGRESSION" << std::endl;
+		return false;
+	}
+	std::cout << (significant ? "Benchmark: improvement" : "Benchmark: no significant change") << std::endl;
+	return true;
+}
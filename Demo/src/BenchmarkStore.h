@@ -0,0 +1,69 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// BenchmarkStore keeps the results of the timing runs in a CSV
+// file, one row per trial, so they outlive the run. A run can be
+// stored as the baseline, or compared with the newest baseline of
+// the same backend, thread count, model options, scenario and host.
+//
+// Single timings vary by several percent from run to run, so a
+// run is a number of trials, each on a freshly set up scenario,
+// and a slowdown only counts as a regression when Welch's t-test
+// finds it significant.
+//
+#ifndef _benchmark_store_h_
+#define _benchmark_store_h_
+
+#include "ped_model.h"
+#include "ModelOptions.h"
+#include <QString>
+#include <vector>
+
+class BenchmarkStore {
+public:
+	struct Run {
+		Ped::IMPLEMENTATION implementation;
+		int threads;
+
+		// ModelOptions::key of the options the trials ran with
+		QString options;
+
+		// Ticks per second of each trial
+		std::vector<double> ticksPerSecond;
+
+		// Median duration in seconds of each stage of a tick over all
+		// trials, or -1 if the backend does not time its stages
+		double stageMedians[Ped::Model::STAGE_COUNT];
+
+		// Mean hardware events per tick of each stage, summed over the
+		// threads that worked on it, or -1 if not counted
+		double stageCounts[Ped::Model::STAGE_COUNT][Ped::Tperfcounters::COUNTER_COUNT];
+	};
+
+	BenchmarkStore(const QString &scenefile, const QString &resultfile = "benchmarks.csv");
+
+	// Runs the scenario trials times, ticks ticks each, on models set
+	// up with the options. With counters
+	// the stages' hardware events are counted too, and printed. Reading
+	// them costs a few system calls per thread and stage, so counted
+	// runs are a little slower.
+	Run measure(Ped::IMPLEMENTATION implementation, int threads, const ModelOptions &options, int trials, int ticks, bool counters = false) const;
+
+	// Appends the run's trials to the results file
+	void store(const Run &run, bool baseline) const;
+
+	// Prints how the run compares with its baseline. Returns false
+	// if it is significantly slower; a run without a baseline passes.
+	bool compare(const Run &run) const;
+
+private:
+	// Ticks per second of the trials of the newest matching baseline
+	std::vector<double> loadBaseline(const Run &run) const;
+
+	QString scenefile;
+	QString resultfile;
+	unsigned long long scenario;
+	unsigned long long host;
+};
+
+#endif
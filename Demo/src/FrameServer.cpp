@@ -0,0 +1,417 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+
+// Before anything that could include Windows.h
+#include "SocketCompat.h"
+
+#include "FrameServer.h"
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <cstring>
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+// Frame rate of a client that asked for none
+#define FRAME_DEFAULT_FPS 30
+
+// Longest the server thread sleeps before checking for stop() or for
+// a client that became ready
+#define FRAME_POLL_MS 5
+
+// Clients beyond this many are turned away
+#define FRAME_MAX_CLIENTS 32
+
+enum { KIND_AGENTS = 0, KIND_HEATMAP = 1 };
+
+static void putVarint(std::vector<unsigned char> &out, size_t value)
+{
+	while (value >= 0x80) {
+		out.push_back((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back((unsigned char)value);
+}
+
+static void putLittleEndian(std::vector<unsigned char> &out, unsigned int value, int bytes)
+{
+	for (int i = 0; i < bytes; i++) {
+		out.push_back((unsigned char)(value >> (8 * i)));
+	}
+}
+
+FrameServer::FrameServer(const Ped::Model &model) : model(model), listener((std::uintptr_t)INVALID_SOCKET),
+	stopRequested(false), frameWanted(false), frameCount(0)
+{
+	chunksPerSide = (SIZE + CHUNK - 1) / CHUNK;
+	chunkCells.resize(chunksPerSide * chunksPerSide);
+}
+
+FrameServer::~FrameServer()
+{
+	stop();
+}
+
+bool FrameServer::start(int port)
+{
+	if (!startSockets()) {
+		std::cerr << "Frame server: cannot start sockets" << std::endl;
+		return false;
+	}
+
+	SOCKET socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (socket == INVALID_SOCKET) {
+		std::cerr << "Frame server: cannot create a socket" << std::endl;
+		stopSockets();
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons((unsigned short)port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(socket, (sockaddr *)&address, sizeof(address)) == SOCKET_ERROR || listen(socket, 8) == SOCKET_ERROR || !setNonBlocking(socket)) {
+		std::cerr << "Frame server: cannot listen on port " << port << std::endl;
+		closesocket(socket);
+		stopSockets();
+		return false;
+	}
+
+	listener = (std::uintptr_t)socket;
+	stopRequested = false;
+	thread = std::thread(&FrameServer::serve, this);
+	std::cout << "Streaming frames on 127.0.0.1:" << port << std::endl;
+	return true;
+}
+
+void FrameServer::stop()
+{
+	if (!thread.joinable()) {
+		return;
+	}
+	stopRequested = true;
+	thread.join();
+	for (size_t i = 0; i < clients.size(); i++) {
+		closesocket((SOCKET)clients[i].socket);
+	}
+	clients.clear();
+	closesocket((SOCKET)listener);
+	listener = (std::uintptr_t)INVALID_SOCKET;
+	stopSockets();
+}
+
+void FrameServer::publish()
+{
+	if (!frameWanted.load(std::memory_order_acquire)) {
+		return;
+	}
+	frameWanted.store(false, std::memory_order_relaxed);
+
+	// Only this thread replaces latest, so it can read it unlocked
+	std::shared_ptr<const Frame> frame = encode(latest.get());
+	std::lock_guard<std::mutex> guard(latestLock);
+	latest = frame;
+}
+
+std::shared_ptr<FrameServer::Frame> FrameServer::encode(const Frame *previous)
+{
+	const int chunks = chunksPerSide * chunksPerSide;
+	std::shared_ptr<Frame> frame(new Frame());
+	frame->number = ++frameCount;
+	frame->agents.resize(chunks);
+	frame->heatmap.resize(chunks);
+	frame->agentsVersion.resize(chunks);
+	frame->heatmapVersion.resize(chunks);
+
+	// Sort the agents into their chunks
+	for (int c = 0; c < chunks; c++) {
+		chunkCells[c].clear();
+	}
+	const std::vector<Ped::Tagent*> &agents = model.getAgents();
+	for (size_t i = 0; i < agents.size(); i++) {
+		const int x = agents[i]->getX();
+		const int y = agents[i]->getY();
+		if (!agents[i]->isActive() || x < 0 || y < 0 || x >= SIZE || y >= SIZE) {
+			continue;
+		}
+		const int chunk = (y / CHUNK) * chunksPerSide + x / CHUNK;
+		chunkCells[chunk].push_back((unsigned short)((y % CHUNK) * CHUNK + x % CHUNK));
+	}
+
+	// The heatmap has a square of scale x scale pixels per cell; each
+	// cell is sampled at the center of its square
+	const int scale = model.getHeatmapSize() / SIZE;
+	int const * const *heatmap = model.getHeatmap();
+	const int blocks = CHUNK / HEATMAP_STEP;
+
+	std::vector<unsigned char> &bytes = frame->bytes;
+	for (int c = 0; c < chunks; c++) {
+		std::vector<unsigned short> &cells = chunkCells[c];
+		std::sort(cells.begin(), cells.end());
+		frame->agents[c].offset = bytes.size();
+		putVarint(bytes, cells.size());
+		unsigned short last = 0;
+		for (size_t i = 0; i < cells.size(); i++) {
+			putVarint(bytes, cells[i] - last);
+			last = cells[i];
+		}
+		frame->agents[c].length = bytes.size() - frame->agents[c].offset;
+
+		frame->heatmap[c].offset = bytes.size();
+		const int chunkLeft = (c % chunksPerSide) * CHUNK;
+		const int chunkTop = (c / chunksPerSide) * CHUNK;
+		for (int by = 0; by < blocks; by++) {
+			for (int bx = 0; bx < blocks; bx++) {
+				int sum = 0;
+				int samples = 0;
+				for (int y = chunkTop + by * HEATMAP_STEP; y < chunkTop + (by + 1) * HEATMAP_STEP && y < SIZE; y++) {
+					for (int x = chunkLeft + bx * HEATMAP_STEP; x < chunkLeft + (bx + 1) * HEATMAP_STEP && x < SIZE; x++) {
+						sum += (unsigned int)heatmap[y * scale + scale / 2][x * scale + scale / 2] >> 24;
+						samples++;
+					}
+				}
+				bytes.push_back((unsigned char)(samples > 0 ? sum / samples : 0));
+			}
+		}
+		frame->heatmap[c].length = bytes.size() - frame->heatmap[c].offset;
+	}
+
+	// A chunk keeps the version of the frame it last changed in, so
+	// clients that have it are not sent it again
+	for (int c = 0; c < chunks; c++) {
+		const Segment &agentsNow = frame->agents[c];
+		const Segment &heatmapNow = frame->heatmap[c];
+		frame->agentsVersion[c] = frame->number;
+		frame->heatmapVersion[c] = frame->number;
+		if (previous == NULL) {
+			continue;
+		}
+		const Segment &agentsBefore = previous->agents[c];
+		if (agentsBefore.length == agentsNow.length &&
+			memcmp(&previous->bytes[agentsBefore.offset], &bytes[agentsNow.offset], agentsNow.length) == 0) {
+			frame->agentsVersion[c] = previous->agentsVersion[c];
+		}
+		const Segment &heatmapBefore = previous->heatmap[c];
+		if (heatmapBefore.length == heatmapNow.length &&
+			memcmp(&previous->bytes[heatmapBefore.offset], &bytes[heatmapNow.offset], heatmapNow.length) == 0) {
+			frame->heatmapVersion[c] = previous->heatmapVersion[c];
+		}
+	}
+	return frame;
+}
+
+bool FrameServer::ready(const Client &client, std::chrono::steady_clock::time_point now) const
+{
+	return client.outSent == client.out.size() && now - client.lastSent >= client.interval;
+}
+
+void FrameServer::serve()
+{
+	while (!stopRequested) {
+		fd_set readable, writable;
+		FD_ZERO(&readable);
+		FD_ZERO(&writable);
+		SOCKET highest = (SOCKET)listener;
+		FD_SET((SOCKET)listener, &readable);
+		for (size_t i = 0; i < clients.size(); i++) {
+			const SOCKET socket = (SOCKET)clients[i].socket;
+			FD_SET(socket, &readable);
+			if (clients[i].outSent < clients[i].out.size()) {
+				FD_SET(socket, &writable);
+			}
+			highest = std::max(highest, socket);
+		}
+		timeval timeout = { 0, FRAME_POLL_MS * 1000 };
+		const int events = select((int)highest + 1, &readable, &writable, NULL, &timeout);
+
+		if (events > 0 && FD_ISSET((SOCKET)listener, &readable)) {
+			accept();
+		}
+		for (size_t i = 0; i < clients.size(); ) {
+			Client &client = clients[i];
+			const SOCKET socket = (SOCKET)client.socket;
+			bool alive = true;
+			if (events > 0 && FD_ISSET(socket, &readable)) {
+				alive = receive(client);
+			}
+			if (alive && events > 0 && FD_ISSET(socket, &writable)) {
+				alive = flush(client);
+			}
+			if (!alive) {
+				closesocket(socket);
+				clients.erase(clients.begin() + i);
+				continue;
+			}
+			i++;
+		}
+
+		// Hand the newest frame to every client that is ready for it,
+		// and ask for a new one if a ready client already has it
+		std::shared_ptr<const Frame> frame;
+		{
+			std::lock_guard<std::mutex> guard(latestLock);
+			frame = latest;
+		}
+		const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		bool waiting = false;
+		for (size_t i = 0; i < clients.size(); i++) {
+			Client &client = clients[i];
+			if (!ready(client, now)) {
+				continue;
+			}
+			if (frame == NULL || frame->number == client.lastFrame) {
+				waiting = true;
+				continue;
+			}
+			compose(client, *frame);
+			client.lastSent = now;
+			client.lastFrame = frame->number;
+			flush(client);
+		}
+		if (waiting) {
+			frameWanted.store(true, std::memory_order_release);
+		}
+	}
+}
+
+void FrameServer::accept()
+{
+	SOCKET socket = ::accept((SOCKET)listener, NULL, NULL);
+	if (socket == INVALID_SOCKET) {
+		return;
+	}
+	if (clients.size() >= FRAME_MAX_CLIENTS || !setNonBlocking(socket)) {
+		closesocket(socket);
+		return;
+	}
+
+	Client client;
+	client.socket = (std::uintptr_t)socket;
+	client.left = 0;
+	client.top = 0;
+	client.right = chunksPerSide - 1;
+	client.bottom = chunksPerSide - 1;
+	client.interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / FRAME_DEFAULT_FPS));
+	client.lastSent = std::chrono::steady_clock::time_point();
+	client.outSent = 0;
+	client.lastFrame = 0;
+	client.agentsVersion.assign(chunksPerSide * chunksPerSide, 0);
+	client.heatmapVersion.assign(chunksPerSide * chunksPerSide, 0);
+
+	client.out.push_back('P');
+	client.out.push_back('H');
+	putLittleEndian(client.out, SIZE, 2);
+	client.out.push_back((unsigned char)CHUNK);
+	client.out.push_back((unsigned char)HEATMAP_STEP);
+	clients.push_back(client);
+	flush(clients.back());
+}
+
+bool FrameServer::receive(Client &client)
+{
+	char buffer[512];
+	const int n = recv((SOCKET)client.socket, buffer, sizeof(buffer), 0);
+	if (n == 0 || (n < 0 && !wouldBlock())) {
+		return false;
+	}
+	if (n < 0) {
+		return true;
+	}
+	client.in.append(buffer, n);
+
+	size_t end;
+	while ((end = client.in.find('\n')) != std::string::npos) {
+		request(client, client.in.substr(0, end));
+		client.in.erase(0, end + 1);
+	}
+
+	// Nothing a client may say is this long
+	return client.in.size() < sizeof(buffer);
+}
+
+void FrameServer::request(Client &client, const std::string &line)
+{
+	std::istringstream words(line);
+	std::string command;
+	words >> command;
+	if (command == "roi") {
+		int x0, y0, x1, y1;
+		if (!(words >> x0 >> y0 >> x1 >> y1)) {
+			return;
+		}
+		client.left = std::max(std::min(x0, x1) / CHUNK, 0);
+		client.top = std::max(std::min(y0, y1) / CHUNK, 0);
+		client.right = std::min(std::max(x0, x1) / CHUNK, chunksPerSide - 1);
+		client.bottom = std::min(std::max(y0, y1) / CHUNK, chunksPerSide - 1);
+	}
+	else if (command == "fps") {
+		double fps;
+		if (words >> fps && fps > 0) {
+			client.interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fps));
+		}
+	}
+}
+
+bool FrameServer::flush(Client &client)
+{
+	while (client.outSent < client.out.size()) {
+		const int n = send((SOCKET)client.socket, (const char *)&client.out[client.outSent], (int)(client.out.size() - client.outSent), SEND_FLAGS);
+		if (n < 0) {
+			return wouldBlock();
+		}
+		client.outSent += n;
+	}
+	client.out.clear();
+	client.outSent = 0;
+	return true;
+}
+
+void FrameServer::compose(Client &client, const Frame &frame)
+{
+	std::vector<unsigned char> &out = client.out;
+	out.clear();
+	client.outSent = 0;
+	out.push_back('P');
+	out.push_back('F');
+	putLittleEndian(out, frame.number, 4);
+	const size_t countAt = out.size();
+	putLittleEndian(out, 0, 2);
+
+	unsigned int count = 0;
+	for (int c = 0; c < chunksPerSide * chunksPerSide; c++) {
+		const int x = c % chunksPerSide;
+		const int y = c / chunksPerSide;
+		if (x < client.left || x > client.right || y < client.top || y > client.bottom) {
+			// Sent again in full if the region of interest comes back
+			client.agentsVersion[c] = 0;
+			client.heatmapVersion[c] = 0;
+			continue;
+		}
+
+		const Segment *segments[2] = { &frame.agents[c], &frame.heatmap[c] };
+		unsigned int *have[2] = { &client.agentsVersion[c], &client.heatmapVersion[c] };
+		const unsigned int now[2] = { frame.agentsVersion[c], frame.heatmapVersion[c] };
+		for (int kind = KIND_AGENTS; kind <= KIND_HEATMAP; kind++) {
+			if (*have[kind] == now[kind]) {
+				continue;
+			}
+			putLittleEndian(out, c, 2);
+			out.push_back((unsigned char)kind);
+			putVarint(out, segments[kind]->length);
+			out.insert(out.end(), frame.bytes.begin() + segments[kind]->offset, frame.bytes.begin() + segments[kind]->offset + segments[kind]->length);
+			*have[kind] = now[kind];
+			count++;
+		}
+	}
+	out[countAt] = (unsigned char)count;
+	out[countAt + 1] = (unsigned char)(count >> 8);
+}
@@ -0,0 +1,150 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// FrameServer streams the simulation to remote viewers over TCP,
+// so it can run headless. The world is cut into square chunks of
+// CHUNK x CHUNK cells. A frame holds, for every chunk, its agents
+// and a downsampled heatmap, each encoded once, when the frame is
+// published; a client is sent only the chunks that lie in its
+// region of interest and changed since it last got them.
+//
+// Clients configure themselves with text lines:
+//   roi X0 Y0 X1 Y1   only send chunks overlapping these cells
+//   fps N             send at most N frames per second
+//
+// The server writes, in little endian:
+//   hello: 'P' 'H' u16 world size in cells, u8 CHUNK, u8 HEATMAP_STEP
+//   frame: 'P' 'F' u32 frame number, u16 number of chunks, then for
+//          each chunk u16 chunk index, u8 kind (0 agents, 1 heatmap),
+//          varint byte count and the bytes
+//
+// An agents chunk is a varint agent count followed by the agents'
+// cells within the chunk (y * CHUNK + x) in increasing order, each
+// as a varint difference from the previous one. A heatmap chunk is
+// (CHUNK / HEATMAP_STEP)^2 bytes, the mean heatmap intensity of
+// each block of HEATMAP_STEP x HEATMAP_STEP cells, row by row.
+//
+// The simulation never waits for a client: publish() only encodes
+// a frame when some client is ready for one, and a client that is
+// still busy with its previous frame skips the newer ones.
+//
+#ifndef _frame_server_h_
+#define _frame_server_h_
+
+#include "ped_model.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+class FrameServer {
+public:
+	// Side length in cells of a chunk, and of the heatmap blocks
+	static const int CHUNK = 64;
+	static const int HEATMAP_STEP = 4;
+
+	explicit FrameServer(const Ped::Model &model);
+
+	// Stops the server if it is running
+	~FrameServer();
+
+	// Starts listening on 127.0.0.1:port. Returns false, after
+	// printing why, if the port cannot be opened.
+	bool start(int port);
+
+	void stop();
+
+	// Called by the simulation thread after each tick
+	void publish();
+
+private:
+	FrameServer(const FrameServer&) = delete;
+	FrameServer &operator=(const FrameServer&) = delete;
+
+	struct Segment {
+		size_t offset;
+		size_t length;
+	};
+
+	// One encoded frame, shared by all clients that send it
+	struct Frame {
+		unsigned int number;
+		std::vector<unsigned char> bytes;
+
+		// Where each chunk's agents and heatmap lie in bytes, and the
+		// number of the frame in which they last changed
+		std::vector<Segment> agents;
+		std::vector<Segment> heatmap;
+		std::vector<unsigned int> agentsVersion;
+		std::vector<unsigned int> heatmapVersion;
+	};
+
+	struct Client {
+		std::uintptr_t socket;
+
+		// Region of interest, in chunks, inclusive
+		int left, top, right, bottom;
+		std::chrono::steady_clock::duration interval;
+		std::chrono::steady_clock::time_point lastSent;
+		unsigned int lastFrame;
+
+		// Unsent rest of the last message, and unparsed request text
+		std::vector<unsigned char> out;
+		size_t outSent;
+		std::string in;
+
+		// Version of each chunk the client has, 0 for none
+		std::vector<unsigned int> agentsVersion;
+		std::vector<unsigned int> heatmapVersion;
+	};
+
+	// Body of the server thread
+	void serve();
+
+	void accept();
+
+	// Reads the client's requests; false if it hung up
+	bool receive(Client &client);
+	void request(Client &client, const std::string &line);
+
+	// Sends what fits of the client's pending message; false on error
+	bool flush(Client &client);
+
+	// Queues the chunks of frame the client is missing
+	void compose(Client &client, const Frame &frame);
+
+	// True if the client may be sent a new frame now
+	bool ready(const Client &client, std::chrono::steady_clock::time_point now) const;
+
+	// Encodes the model's current state, reusing previous's encoding
+	// versions for chunks that did not change
+	std::shared_ptr<Frame> encode(const Frame *previous);
+
+	const Ped::Model &model;
+	int chunksPerSide;
+
+	std::uintptr_t listener;
+	std::thread thread;
+	std::atomic<bool> stopRequested;
+
+	// Set by the server thread when a client waits for a new frame
+	std::atomic<bool> frameWanted;
+
+	// The newest frame. The lock is only held to swap or copy the
+	// pointer, never while encoding or sending.
+	std::mutex latestLock;
+	std::shared_ptr<const Frame> latest;
+	unsigned int frameCount;
+
+	// Owned by the server thread
+	std::vector<Client> clients;
+
+	// Per chunk cell lists, reused by every encode()
+	std::vector<std::vector<unsigned short> > chunkCells;
+};
+
+#endif
@@ -0,0 +1,73 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+
+#include "HostInfo.h"
+#include <QFile>
+#include <thread>
+#include <cstring>
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+static const unsigned long long FNV_PRIME = 1099511628211ull;
+
+unsigned long long HostInfo::fnv1a(unsigned long long hash, const char *data, size_t length)
+{
+	for (size_t i = 0; i < length; i++) {
+		hash ^= (unsigned char)data[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+std::string HostInfo::cpuName()
+{
+	unsigned int registers[12] = { 0 };
+#ifdef _MSC_VER
+	for (int i = 0; i < 3; i++) {
+		__cpuid((int *)&registers[i * 4], 0x80000002 + i);
+	}
+#else
+	for (unsigned int i = 0; i < 3; i++) {
+		__get_cpuid(0x80000002 + i, &registers[i * 4], &registers[i * 4 + 1], &registers[i * 4 + 2], &registers[i * 4 + 3]);
+	}
+#endif
+	char name[sizeof(registers) + 1];
+	memcpy(name, registers, sizeof(registers));
+	name[sizeof(registers)] = '\0';
+
+	// The brand string is padded with spaces on some processors
+	std::string result(name);
+	result.erase(0, result.find_first_not_of(' '));
+	return result;
+}
+
+unsigned long long HostInfo::scenarioHash(const QString &scenefile)
+{
+	unsigned long long hash = FNV_OFFSET;
+	QFile file(scenefile);
+	if (file.open(QIODevice::ReadOnly)) {
+		QByteArray contents = file.readAll();
+		hash = fnv1a(hash, contents.constData(), contents.size());
+	}
+	return hash;
+}
+
+unsigned long long HostInfo::hostHash()
+{
+	std::string cpu = cpuName();
+	unsigned long long hash = fnv1a(FNV_OFFSET, cpu.data(), cpu.size());
+	unsigned int hardwareThreads = std::thread::hardware_concurrency();
+	return fnv1a(hash, (const char *)&hardwareThreads, sizeof(hardwareThreads));
+}
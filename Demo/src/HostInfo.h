@@ -0,0 +1,31 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// HostInfo describes the machine and the scenario a measurement
+// was taken on, so that measurements are only ever compared with
+// others from the same machine and scenario.
+//
+#ifndef _host_info_h_
+#define _host_info_h_
+
+#include <QString>
+#include <string>
+
+class HostInfo {
+public:
+	static const unsigned long long FNV_OFFSET = 14695981039346656037ull;
+
+	// Continues an FNV-1a hash over length more bytes
+	static unsigned long long fnv1a(unsigned long long hash, const char *data, size_t length);
+
+	// The processor's brand string, e.g. "Intel(R) Core(TM) i7-6700 CPU @ 3.40GHz"
+	static std::string cpuName();
+
+	// FNV-1a hash of the scenario file's contents
+	static unsigned long long scenarioHash(const QString &scenefile);
+
+	// FNV-1a hash of the processor's brand string and thread count
+	static unsigned long long hostHash();
+};
+
+#endif
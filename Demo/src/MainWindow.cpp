@@ -6,6 +6,7 @@
 #include <QBrush>
 
 #include <iostream>
+#include <algorithm>
 
 // Memory leak check with msvc++
 #define _CRTDBG_MAP_ALLOC
@@ -15,7 +16,7 @@
 #define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
 #endif
 
-MainWindow::MainWindow(const Ped::Model &pedModel) : model(pedModel)
+MainWindow::MainWindow(const Ped::Model &pedModel) : model(pedModel), heatmapStep(0)
 {
 	// The Window 
 	graphicsView = new QGraphicsView();
@@ -42,6 +43,27 @@ MainWindow::MainWindow(const Ped::Model &pedModel) : model(pedModel)
 		scene->addLine(0, y, 800, y, QPen(Qt::gray));
 	}
 
+	// Paint the walls dark gray, one rectangle per run of blocked cells in a row
+	const Ped::TobstacleGrid &obstacles = model.getObstacleGrid();
+	for (int y = 0; y < obstacles.getHeight(); y++)
+	{
+		int x = 0;
+		while (x < obstacles.getWidth())
+		{
+			if (!obstacles.isBlocked(x, y))
+			{
+				x++;
+				continue;
+			}
+			int start = x;
+			while (x < obstacles.getWidth() && obstacles.isBlocked(x, y))
+			{
+				x++;
+			}
+			scene->addRect(cellToPixel(start), cellToPixel(y), cellToPixel(x - start), cellsizePixel, QPen(Qt::NoPen), QBrush(Qt::darkGray));
+		}
+	}
+
 	// Create viewAgents with references to the position of the model counterparts
 	const std::vector<Ped::Tagent*> &agents = model.getAgents();
 
@@ -50,31 +72,34 @@ MainWindow::MainWindow(const Ped::Model &pedModel) : model(pedModel)
 	for (it = agents.begin(); it != agents.end(); it++)
 	{
 		viewAgents.push_back(new ViewAgent(*it, scene));
+		viewAgents.back()->setVisible((*it)->isActive());
 	}
 
 	const int heatmapSize = model.getHeatmapSize();
 	QPixmap pixmapDummy = QPixmap(heatmapSize, heatmapSize);
 	pixmap = scene->addPixmap(pixmapDummy);
 
-	paint();
 	graphicsView->show(); // Redundant? 
 }
 
-void MainWindow::paint() {
+void MainWindow::paint(const Snapshot &snapshot) {
 
 	// Uncomment this to paint the heatmap (Assignment 4)
-	const int heatmapSize = model.getHeatmapSize();
-	QImage image((uchar*)*model.getHeatmap(), heatmapSize, heatmapSize, heatmapSize * sizeof(int), QImage::Format_ARGB32);
-	//QImage image;
-	pixmap->setPixmap(QPixmap::fromImage(image));
+	paintHeatmap(snapshot);
 
 	// Paint all agents: green, if the only agent on that position, otherwise red
 	std::set<std::tuple<int, int> > positionsTaken;
-	std::vector<ViewAgent*>::iterator it;
-	for (it = viewAgents.begin(); it != viewAgents.end(); it++)
+	for (size_t i = 0; i < viewAgents.size(); i++)
 	{
+		viewAgents[i]->setVisible(snapshot.active[i] != 0);
+		if (!snapshot.active[i])
+		{
+			continue;
+		}
+
+		const std::pair<int, int> &position = snapshot.positions[i];
 		size_t tupleSizeBeforeInsert = positionsTaken.size();
-		positionsTaken.insert((*it)->getPosition());
+		positionsTaken.insert(position);
 		size_t tupleSizeAfterInsert = positionsTaken.size();
 
 		QColor color;
@@ -85,7 +110,102 @@ void MainWindow::paint() {
 			color = Qt::red;
 		}
 
-		(*it)->paint(color);
+		viewAgents[i]->paint(color, position);
+	}
+}
+
+int MainWindow::heatmapDisplayStep() const
+{
+	// Halve the resolution as long as that still gives at least
+	// one heatmap pixel per screen pixel
+	const qreal zoom = graphicsView->transform().m11();
+	int step = 1;
+	while (step < 16 && zoom * step * 2 <= 1.0)
+	{
+		step *= 2;
+	}
+	return step;
+}
+
+void MainWindow::paintHeatmap(const Snapshot &snapshot)
+{
+	const int heatmapSize = snapshot.heatmapSize;
+	const int step = heatmapDisplayStep();
+	if (step != heatmapStep)
+	{
+		// Zoom level changed: start over with a pixmap at the new resolution
+		heatmapStep = step;
+		heatmapPixmap = QPixmap(heatmapSize / step, heatmapSize / step);
+		heatmapPixmap.fill(Qt::transparent);
+		paintedTileVersions.assign(snapshot.tileVersions.size(), 0);
+		tileImage = QImage(Snapshot::TILE / step, Snapshot::TILE / step, QImage::Format_ARGB32);
+		pixmap->setScale(step);
+	}
+
+	// Tiles outside the view are left stale until they are scrolled into view
+	const QRectF visible = graphicsView->mapToScene(graphicsView->viewport()->rect()).boundingRect();
+
+	// Drop the item's reference first, so painting does not deep copy the pixmap
+	pixmap->setPixmap(QPixmap());
+	QPainter painter(&heatmapPixmap);
+	painter.setCompositionMode(QPainter::CompositionMode_Source);
+
+	for (int t = 0; t < (int)snapshot.tileVersions.size(); t++)
+	{
+		if (paintedTileVersions[t] == snapshot.tileVersions[t])
+		{
+			continue;
+		}
+
+		const int left = (t % snapshot.tilesPerSide) * Snapshot::TILE;
+		const int top = (t / snapshot.tilesPerSide) * Snapshot::TILE;
+		const int width = std::min((int)Snapshot::TILE, heatmapSize - left);
+		const int height = std::min((int)Snapshot::TILE, heatmapSize - top);
+		if (!visible.intersects(QRectF(left, top, width, height)))
+		{
+			continue;
+		}
+
+		const int *source = &snapshot.heatmap[(size_t)top * heatmapSize + left];
+		if (step == 1)
+		{
+			// Full resolution: paint straight from the snapshot, no copy
+			QImage tile((const uchar*)source, width, height, heatmapSize * sizeof(int), QImage::Format_ARGB32);
+			painter.drawImage(QPoint(left, top), tile);
+		}
+		else
+		{
+			for (int y = 0; y < height / step; y++)
+			{
+				QRgb *line = (QRgb*)tileImage.scanLine(y);
+				const int *row = source + (size_t)y * step * heatmapSize;
+				for (int x = 0; x < width / step; x++)
+				{
+					line[x] = row[x * step];
+				}
+			}
+			painter.drawImage(QPoint(left / step, top / step), tileImage, QRect(0, 0, width / step, height / step));
+		}
+		paintedTileVersions[t] = snapshot.tileVersions[t];
+	}
+
+	painter.end();
+	pixmap->setPixmap(heatmapPixmap);
+}
+
+void MainWindow::keyPressEvent(QKeyEvent *event)
+{
+	if (event->key() == Qt::Key_Plus)
+	{
+		graphicsView->scale(2.0, 2.0);
+	}
+	else if (event->key() == Qt::Key_Minus)
+	{
+		graphicsView->scale(0.5, 0.5);
+	}
+	else
+	{
+		QMainWindow::keyPressEvent(event);
 	}
 }
 
@@ -3,11 +3,14 @@
 
 #include <QMainWindow>
 #include <QGraphicsScene>
+#include <QPixmap>
+#include <QImage>
 #include <vector>
 
 #include "ped_model.h"
 #include "ped_agent.h"
 #include "ViewAgent.h"
+#include "Snapshot.h"
 class QGraphicsView;
 
 
@@ -16,14 +19,25 @@ public:
 	MainWindow() = delete;
 	MainWindow(const Ped::Model &model);
 
-	// paint is called after each computational step
-	// to repaint the window
-	void paint();
+	// paint is called with the newest snapshot published by
+	// the simulation thread to repaint the window
+	void paint(const Snapshot &snapshot);
 
 	static int cellToPixel(int val);
 	static const int cellsizePixel = 5;
 	~MainWindow();
+
+protected:
+	// '+' and '-' zoom the view in and out
+	void keyPressEvent(QKeyEvent *event);
+
 private:
+	// Uploads the heatmap tiles that changed since the last paint
+	void paintHeatmap(const Snapshot &snapshot);
+
+	// How many heatmap pixels make up one pixel on screen (a power of two)
+	int heatmapDisplayStep() const;
+
 	QGraphicsView *graphicsView;
 	QGraphicsScene * scene;
 
@@ -34,6 +48,16 @@ private:
 
 	// The pixelmap containing the heatmap image (Assignment 4)
 	QGraphicsPixmapItem *pixmap;
+
+	// Persistent heatmap image at display resolution, updated tile by tile
+	QPixmap heatmapPixmap;
+	int heatmapStep;
+
+	// Version of each tile in heatmapPixmap, see Snapshot::tileVersions
+	std::vector<unsigned> paintedTileVersions;
+
+	// Scratch image for downsampling one tile
+	QImage tileImage;
 };
 
 #endif
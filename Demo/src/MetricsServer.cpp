@@ -0,0 +1,196 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+
+// Before anything that could include Windows.h
+#include "SocketCompat.h"
+
+#include "MetricsServer.h"
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#ifdef _WIN32
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#endif
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+// How often, in milliseconds, the server thread checks for stop()
+// while no request comes in
+#define METRICS_POLL_MS 250
+
+// Resident set size of this process in bytes, or -1 if unknown
+static long long residentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+		return counters.WorkingSetSize;
+	}
+	return -1;
+#else
+	long long pages = -1;
+	long long resident = -1;
+	FILE *statm = fopen("/proc/self/statm", "r");
+	if (statm == NULL) {
+		return -1;
+	}
+	if (fscanf(statm, "%lld %lld", &pages, &resident) != 2) {
+		resident = -1;
+	}
+	fclose(statm);
+	return resident < 0 ? -1 : resident * sysconf(_SC_PAGESIZE);
+#endif
+}
+
+MetricsServer::MetricsServer(const Ped::Tmetrics &metrics) : metrics(metrics), listener((std::uintptr_t)INVALID_SOCKET),
+	stopRequested(false), lastTicks(0)
+{
+}
+
+MetricsServer::~MetricsServer()
+{
+	stop();
+}
+
+bool MetricsServer::start(int port)
+{
+	if (!startSockets()) {
+		std::cerr << "Metrics: cannot start sockets" << std::endl;
+		return false;
+	}
+
+	SOCKET socket = ::socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (socket == INVALID_SOCKET) {
+		std::cerr << "Metrics: cannot create a socket" << std::endl;
+		stopSockets();
+		return false;
+	}
+	int reuse = 1;
+	setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, (const char *)&reuse, sizeof(reuse));
+
+	// Only this machine may scrape
+	sockaddr_in address = {};
+	address.sin_family = AF_INET;
+	address.sin_port = htons((unsigned short)port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(socket, (sockaddr *)&address, sizeof(address)) == SOCKET_ERROR || listen(socket, 4) == SOCKET_ERROR) {
+		std::cerr << "Metrics: cannot listen on port " << port << std::endl;
+		closesocket(socket);
+		stopSockets();
+		return false;
+	}
+
+	listener = (std::uintptr_t)socket;
+	lastTicks = metrics.total(Ped::Tmetrics::TICKS);
+	lastRequest = std::chrono::steady_clock::now();
+	stopRequested = false;
+	thread = std::thread(&MetricsServer::serve, this);
+	std::cout << "Metrics on http://127.0.0.1:" << port << "/metrics" << std::endl;
+	return true;
+}
+
+void MetricsServer::stop()
+{
+	if (!thread.joinable()) {
+		return;
+	}
+	stopRequested = true;
+	thread.join();
+	closesocket((SOCKET)listener);
+	listener = (std::uintptr_t)INVALID_SOCKET;
+	stopSockets();
+}
+
+void MetricsServer::serve()
+{
+	const SOCKET socket = (SOCKET)listener;
+	while (!stopRequested) {
+		// Wait for a connection, but not so long that stop() has to wait
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(socket, &readable);
+		timeval timeout = { 0, METRICS_POLL_MS * 1000 };
+		if (select((int)socket + 1, &readable, NULL, NULL, &timeout) <= 0) {
+			continue;
+		}
+
+		SOCKET client = accept(socket, NULL, NULL);
+		if (client == INVALID_SOCKET) {
+			continue;
+		}
+
+		// Every request gets the metrics, so the request itself is only
+		// read to leave the connection clean
+		char request[1024];
+		recv(client, request, sizeof(request), 0);
+
+		const std::string body = render();
+		std::ostringstream response;
+		response << "HTTP/1.0 200 OK\r\n"
+			<< "Content-Type: text/plain; version=0.0.4\r\n"
+			<< "Content-Length: " << body.size() << "\r\n"
+			<< "Connection: close\r\n\r\n"
+			<< body;
+		const std::string text = response.str();
+		size_t sent = 0;
+		while (sent < text.size()) {
+			const int n = send(client, text.data() + sent, (int)(text.size() - sent), 0);
+			if (n <= 0) {
+				break;
+			}
+			sent += n;
+		}
+		closesocket(client);
+	}
+}
+
+std::string MetricsServer::render()
+{
+	std::ostringstream out;
+
+	const long long ticks = metrics.total(Ped::Tmetrics::TICKS);
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	const double elapsed = std::chrono::duration<double>(now - lastRequest).count();
+	const double ticksPerSecond = elapsed > 0 ? (ticks - lastTicks) / elapsed : 0;
+	lastTicks = ticks;
+	lastRequest = now;
+
+	out << "# TYPE pedsim_ticks_per_second gauge\n"
+		<< "pedsim_ticks_per_second " << ticksPerSecond << "\n";
+	for (int c = 0; c < Ped::Tmetrics::COUNTER_COUNT; c++) {
+		const char *name = Ped::Tmetrics::name((Ped::Tmetrics::COUNTER)c);
+		out << "# TYPE pedsim_" << name << "_total counter\n"
+			<< "pedsim_" << name << "_total " << metrics.total((Ped::Tmetrics::COUNTER)c) << "\n";
+	}
+
+	static const double quantiles[] = { 0.5, 0.9, 0.99, 1.0 };
+	for (int l = 0; l < Ped::Tmetrics::LATENCY_COUNT; l++) {
+		const char *name = Ped::Tmetrics::name((Ped::Tmetrics::LATENCY)l);
+		if (metrics.percentile((Ped::Tmetrics::LATENCY)l, 50) < 0) {
+			continue;
+		}
+		out << "# TYPE pedsim_" << name << "_seconds summary\n";
+		for (int q = 0; q < sizeof(quantiles) / sizeof(quantiles[0]); q++) {
+			out << "pedsim_" << name << "_seconds{quantile=\"" << quantiles[q] << "\"} "
+				<< metrics.percentile((Ped::Tmetrics::LATENCY)l, quantiles[q] * 100.0) << "\n";
+		}
+	}
+
+	out << "# TYPE pedsim_agents gauge\n"
+		<< "pedsim_agents " << metrics.getAgentCount() << "\n";
+
+	const long long resident = residentBytes();
+	if (resident >= 0) {
+		out << "# TYPE pedsim_resident_bytes gauge\n"
+			<< "pedsim_resident_bytes " << resident << "\n";
+	}
+	return out.str();
+}
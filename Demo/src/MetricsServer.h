@@ -0,0 +1,60 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// MetricsServer serves the live metrics of a running simulation
+// over HTTP on 127.0.0.1, in the Prometheus text format, from a
+// background thread. Every request, whatever its path, gets the
+// current values: ticks per second since the previous request,
+// tick, movement and heatmap latency percentiles, the agent count,
+// collision retries and failures, and the resident set size.
+//
+// The server only reads the Ped::Tmetrics the model writes, so the
+// simulation never waits for it.
+//
+#ifndef _metrics_server_h_
+#define _metrics_server_h_
+
+#include "ped_metrics.h"
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <cstdint>
+
+class MetricsServer {
+public:
+	explicit MetricsServer(const Ped::Tmetrics &metrics);
+
+	// Stops the server if it is running
+	~MetricsServer();
+
+	// Starts listening on the port. Returns false, after printing why,
+	// if the port cannot be opened.
+	bool start(int port);
+
+	void stop();
+
+private:
+	MetricsServer(const MetricsServer&) = delete;
+	MetricsServer &operator=(const MetricsServer&) = delete;
+
+	// Body of the server thread
+	void serve();
+
+	// The response body for one request
+	std::string render();
+
+	const Ped::Tmetrics &metrics;
+
+	// The listening socket, as an integer so this header needs no
+	// socket headers
+	std::uintptr_t listener;
+	std::thread thread;
+	std::atomic<bool> stopRequested;
+
+	// Tick count and time of the previous request, for ticks per second
+	long long lastTicks;
+	std::chrono::steady_clock::time_point lastRequest;
+};
+
+#endif
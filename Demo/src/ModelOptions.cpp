@@ -0,0 +1,39 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+
+#include "ModelOptions.h"
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+ModelOptions::ModelOptions() : blur(5), levelOfDetail(false), hybrid(false)
+{
+}
+
+bool ModelOptions::levelOfDetailFor(Ped::IMPLEMENTATION implementation) const
+{
+	return levelOfDetail && (implementation == Ped::SEQCOLLISION || implementation == Ped::SEQCOLLISIONOMP);
+}
+
+bool ModelOptions::hybridFor(Ped::IMPLEMENTATION implementation) const
+{
+	return hybrid && implementation == Ped::HEATMAP_SEQ;
+}
+
+bool ModelOptions::apply(Ped::Model &model, Ped::IMPLEMENTATION implementation) const
+{
+	model.setLevelOfDetail(levelOfDetailFor(implementation));
+	model.setHybrid(hybridFor(implementation));
+	return model.setHeatmapBlur(blur);
+}
+
+QString ModelOptions::key(Ped::IMPLEMENTATION implementation) const
+{
+	return QString("blur=%1 lod=%2 hybrid=%3").arg(blur).arg(levelOfDetailFor(implementation) ? 1 : 0).arg(hybridFor(implementation) ? 1 : 0);
+}
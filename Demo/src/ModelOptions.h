@@ -0,0 +1,37 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// ModelOptions holds the model settings given on the command line,
+// so that every model a run sets up, the shown one, the timed one
+// and the benchmark trials, is configured the same way.
+//
+#ifndef _model_options_h_
+#define _model_options_h_
+
+#include "ped_model.h"
+#include <QString>
+
+struct ModelOptions {
+	// See Model::setHeatmapBlur, setLevelOfDetail and setHybrid
+	int blur;
+	bool levelOfDetail;
+	bool hybrid;
+
+	ModelOptions();
+
+	// Applies the options to a model set up for the implementation. The
+	// level of detail only applies to SEQCOLLISION and SEQCOLLISIONOMP,
+	// the hybrid model only to HEATMAP_SEQ. Returns false if the blur
+	// size is unsupported, which leaves the model's blur as it was.
+	bool apply(Ped::Model &model, Ped::IMPLEMENTATION implementation) const;
+
+	// The options in effect for the implementation, e.g.
+	// "blur=5 lod=0 hybrid=0", for telling stored results apart
+	QString key(Ped::IMPLEMENTATION implementation) const;
+
+private:
+	bool levelOfDetailFor(Ped::IMPLEMENTATION implementation) const;
+	bool hybridFor(Ped::IMPLEMENTATION implementation) const;
+};
+
+#endif
@@ -26,7 +26,7 @@ bool positionComparator(Ped::Tagent *a, Ped::Tagent *b) {
 
 /// object constructor
 /// \date    2011-01-03
-ParseScenario::ParseScenario(QString filename) : QObject(0)
+ParseScenario::ParseScenario(QString filename, Ped::Model &model) : QObject(0), model(model), currentSource(NULL)
 {
 	QFile file(filename);
 	if (!file.open(QIODevice::ReadOnly | QIODevice::Text))
@@ -41,7 +41,8 @@ ParseScenario::ParseScenario(QString filename) : QObject(0)
 		processXmlLine(line);
 	}
 
-	// Hack! Do not allow agents to be on the same position. Remove duplicates from scenario and free the memory.
+	// Hack! Do not allow agents to be on the same position. Remove duplicates from scenario;
+	// their memory is freed with the model's pool.
 	bool(*fn_pt)(Ped::Tagent*, Ped::Tagent*) = positionComparator;
 	std::set<Ped::Tagent*, bool(*)(Ped::Tagent*, Ped::Tagent*)> agentsWithUniquePosition(fn_pt);
 	int duplicates = 0;
@@ -53,7 +54,6 @@ ParseScenario::ParseScenario(QString filename) : QObject(0)
 		}
 		else
 		{
-			delete agent;
 			duplicates += 1;
 		}
 	}
@@ -80,6 +80,21 @@ std::vector<Ped::Twaypoint*> ParseScenario::getWaypoints()
 	return std::move(v);
 }
 
+std::vector<Ped::Tobstacle*> ParseScenario::getObstacles() const
+{
+	return obstacles;
+}
+
+std::vector<Ped::Tsource*> ParseScenario::getSources() const
+{
+	return sources;
+}
+
+std::vector<Ped::Tsink*> ParseScenario::getSinks() const
+{
+	return sinks;
+}
+
 /// Called for each line in the file
 void ParseScenario::processXmlLine(QByteArray dataLine)
 {
@@ -115,13 +130,38 @@ void ParseScenario::handleXmlStartElement()
 		createAgents();
 	}
 
+	// New wall
+	else if (xmlReader.name() == "obstacle")
+	{
+		createObstacle();
+	}
+
+	// New entrance
+	else if (xmlReader.name() == "source")
+	{
+		createSource();
+	}
+
+	// New exit
+	else if (xmlReader.name() == "sink")
+	{
+		createSink();
+	}
+
 	// Add waypoint that was defined earlier by "createWaypoint"
-	// to all agents
+	// to all agents, or to the source that is being defined
 	else if (xmlReader.name() == "addwaypoint")
 	{
 		// Get waypoint by id
 		QString id = readString("id");
-		addWaypointToCurrentAgents(id);
+		if (currentSource != NULL)
+		{
+			addWaypointToCurrentSource(id);
+		}
+		else
+		{
+			addWaypointToCurrentAgents(id);
+		}
 	}
 	else
 	{
@@ -141,6 +181,9 @@ void ParseScenario::handleXmlEndElement()
 			agents.push_back(a);
 		}
 	}
+	else if (xmlReader.name() == "source") {
+		currentSource = NULL;
+	}
 }
 
 void ParseScenario::createWaypoint()
@@ -150,7 +193,7 @@ void ParseScenario::createWaypoint()
 	double y = readDouble("y");
 	double r = readDouble("r");
 
-	Ped::Twaypoint *w = new Ped::Twaypoint(x, y, r);
+	Ped::Twaypoint *w = model.createWaypoint(x, y, r);
 	waypoints[id] = w;
 }
 
@@ -163,15 +206,77 @@ void ParseScenario::createAgents()
 	double dy = readDouble("dy");
 
 	tempAgents.clear();
+	model.reserveAgents(n);
 	for (int i = 0; i < n; ++i)
 	{
 		int xPos = x + qrand() / (RAND_MAX / dx) - dx / 2;
 		int yPos = y + qrand() / (RAND_MAX / dy) - dy / 2;
-		Ped::Tagent *a = new Ped::Tagent(xPos, yPos);
+		Ped::Tagent *a = model.createAgent(xPos, yPos);
 		tempAgents.push_back(a);
 	}
 }
 
+void ParseScenario::createObstacle()
+{
+	QString type = readString("type");
+	if (type == "rect")
+	{
+		int x = readDouble("x");
+		int y = readDouble("y");
+		int w = readDouble("w");
+		int h = readDouble("h");
+		obstacles.push_back(new Ped::Tobstacle(x, y, w, h));
+	}
+	else if (type == "polyline")
+	{
+		std::vector<std::pair<int, int> > points;
+		QStringList coordinates = readString("points").split(' ', QString::SkipEmptyParts);
+		foreach(QString coordinate, coordinates)
+		{
+			QStringList xy = coordinate.split(',');
+			if (xy.size() == 2)
+			{
+				points.push_back(std::make_pair((int)xy[0].toDouble(), (int)xy[1].toDouble()));
+			}
+		}
+		if (!points.empty())
+		{
+			obstacles.push_back(new Ped::Tobstacle(points));
+		}
+	}
+	else
+	{
+		std::cout << "Warning: unknown obstacle type \"" << type.toStdString() << "\". Ignoring ..." << std::endl;
+	}
+}
+
+void ParseScenario::createSource()
+{
+	double x = readDouble("x");
+	double y = readDouble("y");
+	double dx = readDouble("dx");
+	double dy = readDouble("dy");
+	double rate = readDouble("rate");
+	int max = readDouble("max");
+
+	currentSource = new Ped::Tsource(x, y, dx, dy, rate, max);
+	sources.push_back(currentSource);
+}
+
+void ParseScenario::createSink()
+{
+	double x = readDouble("x");
+	double y = readDouble("y");
+	double r = readDouble("r");
+
+	sinks.push_back(new Ped::Tsink(x, y, r));
+}
+
+void ParseScenario::addWaypointToCurrentSource(QString &id)
+{
+	currentSource->addWaypoint(waypoints[id]);
+}
+
 void ParseScenario::addWaypointToCurrentAgents(QString &id)
 {
 	Ped::Tagent *a;
@@ -11,6 +11,9 @@
 
 #include "ped_agent.h"
 #include "ped_waypoint.h"
+#include "ped_obstacle.h"
+#include "ped_source.h"
+#include "ped_model.h"
 #include <QtCore>
 #include <QXmlStreamReader>
 #include <vector>
@@ -23,11 +26,18 @@ class ParseScenario : public QObject
 	Q_OBJECT
 
 public:
-	ParseScenario(QString file);
+	// Agents and waypoints are created in (and owned by) the model
+	ParseScenario(QString file, Ped::Model &model);
 
 	// returns the collection of agents defined by this scenario
 	vector<Ped::Tagent*> getAgents() const;
 	std::vector<Ped::Twaypoint*> getWaypoints();
+	// returns the walls defined by this scenario
+	std::vector<Ped::Tobstacle*> getObstacles() const;
+
+	// returns the entrances and exits defined by this scenario
+	std::vector<Ped::Tsource*> getSources() const;
+	std::vector<Ped::Tsink*> getSinks() const;
 	private slots:
 	void processXmlLine(QByteArray data);
 	// contains all defined waypoints
@@ -35,6 +45,9 @@ public:
 private:
 	QXmlStreamReader xmlReader;
 
+	// the model that owns the created agents and waypoints
+	Ped::Model &model;
+
 	// final collection of all created agents
 	vector<Ped::Tagent*> agents;
 
@@ -46,7 +59,17 @@ private:
 	// contains all defined waypoints
 	map<QString, Ped::Twaypoint*> waypoints;
 
-	// decides what to do on a new xml tag (tags: agent, waypoint, addwaypoint)
+	// contains all defined obstacles
+	vector<Ped::Tobstacle*> obstacles;
+
+	// contains all defined sources and sinks
+	vector<Ped::Tsource*> sources;
+	vector<Ped::Tsink*> sinks;
+
+	// the source whose xml tag is currently open, if any
+	Ped::Tsource *currentSource;
+
+	// decides what to do on a new xml tag (tags: agent, waypoint, addwaypoint, obstacle, source, sink)
 	void handleXmlStartElement();
 
 	// decides what to do if an xml tag is closed
@@ -58,6 +81,21 @@ private:
 	// creates a new agents on an agent xml tag
 	void createAgents();
 
+	// creates a new obstacle on an obstacle xml tag, either
+	// <obstacle type="rect" x="" y="" w="" h="" /> or
+	// <obstacle type="polyline" points="x,y x,y ..." />
+	void createObstacle();
+
+	// creates a new source on a source xml tag:
+	// <source x="" y="" dx="" dy="" rate="" max=""> with addwaypoint tags
+	void createSource();
+
+	// creates a new sink on a sink xml tag: <sink x="" y="" r="" />
+	void createSink();
+
+	// add (by ID-)defined waypoint to the current source
+	void addWaypointToCurrentSource(QString &id);
+
 	// add (by ID-)defined waypoint to current agents
 	void addWaypointToCurrentAgents(QString &id);
 
@@ -2,7 +2,7 @@
 // Low Level Parallel Programming 2016.
 //
 //     ==== There is no need to change this file ====
-// 
+//
 
 #include "PedSimulation.h"
 #include <iostream>
@@ -18,21 +18,54 @@
 
 using namespace std;
 
-PedSimulation::PedSimulation(Ped::Model &model_, MainWindow &window_) : model(model_), window(window_), maxSimulationSteps(-1)
+PedSimulation::PedSimulation(Ped::Model &model_, MainWindow &window_) : model(model_), window(window_), maxSimulationSteps(-1), tickCounter(0), stopRequested(false), simulationDone(false)
+{
+}
+
+PedSimulation::~PedSimulation()
 {
-	tickCounter = 0;
+	stop();
 }
 
 int PedSimulation::getTickCount() const
 {
 	return tickCounter;
 }
-void PedSimulation::simulateOneStep()
+
+void PedSimulation::stop()
 {
-	tickCounter++;
-	model.tick();
-	window.paint();
-	if (maxSimulationSteps-- == 0)
+	stopRequested = true;
+	if (simulationThread.joinable())
+	{
+		simulationThread.join();
+	}
+}
+
+void PedSimulation::simulationLoop()
+{
+	for (int i = 0; i < maxSimulationSteps && !stopRequested; i++)
+	{
+		model.tick();
+		tickCounter++;
+
+		// Versions start at 1, so the first snapshot copies every tile
+		Snapshot::markDirty(model, heatmapTileVersions, tickCounter + 1);
+		snapshots.writeSlot().capture(model, tickCounter, heatmapTileVersions);
+		snapshots.publish();
+	}
+	simulationDone = true;
+}
+
+void PedSimulation::paintLatestSnapshot()
+{
+	// Check before picking up the snapshot, so the final frame is painted
+	bool done = simulationDone;
+
+	if (snapshots.update())
+	{
+		window.paint(snapshots.readSlot());
+	}
+	if (done)
 	{
 		QApplication::quit();
 	}
@@ -42,9 +75,18 @@ void PedSimulation::runSimulationWithQt(int maxNumberOfStepsToSimulate)
 {
 	maxSimulationSteps = maxNumberOfStepsToSimulate;
 
-	//movetimer.setInterval(50); // Limits the simulation to 20 FPS (if one so whiches).
-	QObject::connect(&movetimer, SIGNAL(timeout()), this, SLOT(simulateOneStep()));
-	movetimer.start();
+	// All buffers are allocated up front; capturing a snapshot only copies.
+	for (int i = 0; i < 3; i++)
+	{
+		snapshots.slot(i).reserve(model);
+	}
+	heatmapTileVersions.assign(snapshots.slot(0).tileVersions.size(), 1);
+
+	simulationThread = std::thread(&PedSimulation::simulationLoop, this);
+
+	painttimer.setInterval(16); // Paint at display rate, ~60 FPS.
+	QObject::connect(&painttimer, SIGNAL(timeout()), this, SLOT(paintLatestSnapshot()));
+	painttimer.start();
 }
 
 void PedSimulation::runSimulationWithoutQt(int maxNumberOfStepsToSimulate)
@@ -1,17 +1,25 @@
 ///////////////////////////////////////////////////
 // Low Level Parallel Programming 2016.
 //
-//     ==== Don't change this file! ====
-//
 // PedSimulation wraps the lipbedsim library and
 // provides functionality to start the crowd simulation.
 //
+// With the GUI, the model is ticked on a separate simulation
+// thread. After every tick it publishes a Snapshot through a
+// TripleBuffer, and the GUI thread paints the newest snapshot
+// at display rate. Neither thread ever waits for the other.
+//
 #ifndef _timer_h_
 #define _timer_h_
 
 #include <QTimer>
+#include <atomic>
+#include <thread>
 #include "ped_model.h"
 #include "MainWindow.h"
+#include "Snapshot.h"
+#include "TripleBuffer.h"
+
 // Driver for updating the world
 class PedSimulation : public QObject{
 	Q_OBJECT
@@ -19,22 +27,42 @@ class PedSimulation : public QObject{
 public:
 	PedSimulation(Ped::Model &model, MainWindow &window);
 	PedSimulation() = delete;
+	~PedSimulation();
 
 	// Running simulation without GUI. Use for profiling.
 	void runSimulationWithoutQt(int maxNumberOfStepsToSimulate);
 
 	// Running simulation with GUI. Use for visualization.
+	// Starts the simulation thread and returns immediately.
 	void runSimulationWithQt(int maxNumberOfStepsToSimulate);
 	int getTickCount() const;
+
+	// Stops the simulation thread (if running) and waits for it.
+	void stop();
+
 	public slots:
-	// Performs one simulation step
-	void simulateOneStep();
+	// Paints the newest snapshot, if the simulation published one
+	// since the last call. Quits when the simulation is done.
+	void paintLatestSnapshot();
 
 private:
+	// Body of the simulation thread
+	void simulationLoop();
+
 	Ped::Model &model;
 	MainWindow &window;
-	QTimer movetimer;
+	QTimer painttimer;
 	int maxSimulationSteps;
-	int tickCounter;
+	std::atomic<int> tickCounter;
+
+	std::thread simulationThread;
+	std::atomic<bool> stopRequested;
+	std::atomic<bool> simulationDone;
+
+	// Frames handed from the simulation thread to the GUI thread
+	TripleBuffer<Snapshot> snapshots;
+
+	// Current version of every heatmap tile, see Snapshot::markDirty
+	std::vector<unsigned> heatmapTileVersions;
 };
 #endif
@@ -0,0 +1,100 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// Snapshot is a copy of everything the view needs to draw one
+// frame: the agent positions and the blurred heatmap. The heatmap
+// is kept up to date tile by tile, so a snapshot only copies the
+// tiles that changed since the slot was last written. The
+// simulation thread fills snapshots and hands them to the GUI
+// thread through a TripleBuffer, so the GUI never reads the
+// model while tick() is changing it.
+//
+#ifndef _snapshot_h_
+#define _snapshot_h_
+
+#include <vector>
+#include <utility>
+#include <algorithm>
+
+#include "ped_model.h"
+
+struct Snapshot {
+	// Side length of the square heatmap tiles. Only tiles whose
+	// version changed are copied into a snapshot or uploaded to
+	// the view.
+	static const int TILE = 128;
+
+	// Number of ticks simulated when this snapshot was taken
+	int tick;
+
+	// Position of every agent, in the order of Model::getAgents()
+	std::vector<std::pair<int, int> > positions;
+
+	// Nonzero for the agents that are in the simulation; the others
+	// are free slots and are not drawn
+	std::vector<char> active;
+
+	// Copy of the blurred heatmap, heatmapSize * heatmapSize pixels
+	std::vector<int> heatmap;
+	int heatmapSize;
+
+	// Version of each heatmap tile held by this snapshot, row by row
+	std::vector<unsigned> tileVersions;
+	int tilesPerSide;
+
+	Snapshot() : tick(0), heatmapSize(0), tilesPerSide(0) {}
+
+	// Allocates the buffers once, so capture() never has to.
+	void reserve(const Ped::Model &model) {
+		positions.resize(model.getAgents().size());
+		active.resize(model.getAgents().size());
+		heatmapSize = model.getHeatmapSize();
+		heatmap.resize((size_t)heatmapSize * heatmapSize);
+		tilesPerSide = (heatmapSize + TILE - 1) / TILE;
+		tileVersions.assign(tilesPerSide * tilesPerSide, 0);
+	}
+
+	// Gives every tile touched by the model's dirty rectangles of the
+	// last tick the new version.
+	static void markDirty(const Ped::Model &model, std::vector<unsigned> &versions, unsigned version) {
+		const int tiles = (model.getHeatmapSize() + TILE - 1) / TILE;
+		const std::vector<Ped::HeatmapRect> &rects = model.getHeatmapDirtyRects();
+		for (size_t i = 0; i < rects.size(); i++) {
+			const Ped::HeatmapRect &r = rects[i];
+			for (int ty = r.y / TILE; ty <= (r.y + r.height - 1) / TILE && ty < tiles; ty++) {
+				for (int tx = r.x / TILE; tx <= (r.x + r.width - 1) / TILE && tx < tiles; tx++) {
+					versions[ty * tiles + tx] = version;
+				}
+			}
+		}
+	}
+
+	// Copies the current state of the model into this snapshot. Only
+	// heatmap tiles older than currentVersions are copied.
+	void capture(const Ped::Model &model, int tickCount, const std::vector<unsigned> &currentVersions) {
+		const std::vector<Ped::Tagent*> &agents = model.getAgents();
+		for (size_t i = 0; i < agents.size(); i++) {
+			positions[i] = std::make_pair(agents[i]->getX(), agents[i]->getY());
+			active[i] = agents[i]->isActive();
+		}
+
+		const int *source = *model.getHeatmap();
+		for (int t = 0; t < (int)tileVersions.size(); t++) {
+			if (tileVersions[t] == currentVersions[t]) {
+				continue;
+			}
+			const int left = (t % tilesPerSide) * TILE;
+			const int top = (t / tilesPerSide) * TILE;
+			const int width = std::min(TILE, heatmapSize - left);
+			const int height = std::min(TILE, heatmapSize - top);
+			for (int y = top; y < top + height; y++) {
+				const size_t row = (size_t)y * heatmapSize + left;
+				std::copy(source + row, source + row + width, heatmap.begin() + row);
+			}
+			tileVersions[t] = currentVersions[t];
+		}
+		tick = tickCount;
+	}
+};
+
+#endif
@@ -0,0 +1,88 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// The few socket calls the metrics endpoint and the frame server
+// need, with the same names on Winsock and on POSIX systems.
+// Include it before anything that includes Windows.h, which would
+// otherwise pull in the old winsock.h.
+//
+#ifndef _socket_compat_h_
+#define _socket_compat_h_
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+
+typedef int socklen_t;
+
+// Flags for send(); Winsock never raises SIGPIPE
+#define SEND_FLAGS 0
+
+inline bool startSockets()
+{
+	WSADATA data;
+	return WSAStartup(MAKEWORD(2, 2), &data) == 0;
+}
+
+inline void stopSockets()
+{
+	WSACleanup();
+}
+
+inline bool setNonBlocking(SOCKET socket)
+{
+	u_long on = 1;
+	return ioctlsocket(socket, FIONBIO, &on) == 0;
+}
+
+inline bool wouldBlock()
+{
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+}
+#else
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <cerrno>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+// A client that hung up must not kill the server with SIGPIPE
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+inline int closesocket(SOCKET socket)
+{
+	return close(socket);
+}
+
+inline bool startSockets()
+{
+	return true;
+}
+
+inline void stopSockets()
+{
+}
+
+inline bool setNonBlocking(SOCKET socket)
+{
+	return fcntl(socket, F_SETFL, fcntl(socket, F_GETFL, 0) | O_NONBLOCK) == 0;
+}
+
+inline bool wouldBlock()
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+#endif
+
+#endif
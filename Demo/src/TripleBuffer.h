@@ -0,0 +1,62 @@
+///////////////////////////////////////////////////
+// Low Level Parallel Programming 2017.
+//
+// TripleBuffer hands values from one producer thread to one
+// consumer thread without either side ever blocking. The
+// producer always owns a back slot and the consumer a front
+// slot; the third slot sits in the middle and is swapped
+// atomically by whichever side is done with its own slot.
+//
+#ifndef _triple_buffer_h_
+#define _triple_buffer_h_
+
+#include <atomic>
+
+template <typename T>
+class TripleBuffer {
+public:
+	TripleBuffer() : back(0), middle(1), front(2) {}
+
+	// Direct access to a slot, only for setting up all three
+	// slots before the producer and consumer threads start.
+	T &slot(int i) { return slots[i]; }
+
+	// The slot the producer fills with the next value.
+	T &writeSlot() { return slots[back]; }
+
+	// Publishes the write slot. The producer gets the previous
+	// middle slot back, which the consumer is guaranteed not to read.
+	void publish() {
+		back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & INDEX;
+	}
+
+	// Makes the newest published value available through readSlot().
+	// Returns false if nothing was published since the last call.
+	bool update() {
+		if ((middle.load(std::memory_order_acquire) & FRESH) == 0) {
+			return false;
+		}
+		front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+		return true;
+	}
+
+	// The newest value the consumer has picked up with update().
+	const T &readSlot() const { return slots[front]; }
+
+private:
+	enum { INDEX = 3, FRESH = 4 };
+
+	T slots[3];
+
+	// Only touched by the producer
+	int back;
+
+	// Index of the middle slot; FRESH is set when it holds a value
+	// the consumer has not picked up yet
+	std::atomic<int> middle;
+
+	// Only touched by the consumer
+	int front;
+};
+
+#endif
@@ -13,12 +13,14 @@
 class ViewAgent{
 public:
 	ViewAgent(Ped::Tagent * agent, QGraphicsScene * scene);
-	void paint(QColor color);
-	const std::pair<int, int> getPosition();
 
-private:
-	const Ped::Tagent *agent;
+	// Moves the agent's rectangle to the given cell position
+	void paint(QColor color, const std::pair<int, int> &position);
+
+	// Shows or hides the agent, e.g. while its slot is free
+	void setVisible(bool visible);
 
+private:
 	// The rectangle on the GUI representing this agent
 	QGraphicsRectItem * rect;
 	QGraphicsPixmapItem * bgt_icon;
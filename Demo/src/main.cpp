@@ -21,10 +21,18 @@
 #include <thread>
 
 #include "PedSimulation.h"
+#include "AllocationCounter.h"
+#include "AutoTuner.h"
+#include "BenchmarkStore.h"
+#include "ModelOptions.h"
+#include "MetricsServer.h"
+#include "FrameServer.h"
 #include <iostream>
 #include <chrono>
+#include <memory>
 #include <ctime>
 #include <cstring>
+#include <csignal>
 
 #pragma comment(lib, "libpedsim.lib")
 
@@ -36,8 +44,86 @@
 #define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
 #endif
 
+// Ticks per second of the headless server, --serve
+#define SERVE_TICKS_PER_SECOND 60
+
+// Set on SIGINT or SIGTERM, so that the headless server shuts down
+// cleanly instead of being killed
+static volatile std::sig_atomic_t stopServing = 0;
+
+static void requestStop(int)
+{
+	stopServing = 1;
+}
+
+// Runs every CPU backend on the scenario and reports the allocations
+// its ticks make once warmed up: the first ticks may still build flow
+// fields and grow buffers. The backends that have a level of detail or
+// a hybrid model run once more with it turned on. Returns false if any
+// tick allocated.
+static bool checkTickAllocations(const QString &scenefile)
+{
+	const Ped::IMPLEMENTATION implementations[] = {
+		Ped::SEQ, Ped::OMP, Ped::PTHREAD, Ped::VECTOR, Ped::VECTOROMP, Ped::SEQCOLLISION,
+		Ped::SEQCOLLISIONOMP, Ped::REGION, Ped::HEATMAP_SEQ, Ped::INTSTEP, Ped::FLOWFIELD
+	};
+	const char *names[] = {
+		"SEQ", "OMP", "PTHREAD", "VECTOR", "VECTOROMP", "SEQCOLLISION",
+		"SEQCOLLISIONOMP", "REGION", "HEATMAP_SEQ", "INTSTEP", "FLOWFIELD"
+	};
+	const int warmupTicks = 300;
+	const int checkedTicks = 300;
+
+	ModelOptions plain;
+	ModelOptions everything;
+	everything.levelOfDetail = true;
+	everything.hybrid = true;
+	const ModelOptions *passes[] = { &plain, &everything };
+
+	bool allocationFree = true;
+	for (int pass = 0; pass < 2; pass++) {
+		const ModelOptions &options = *passes[pass];
+		for (int i = 0; i < sizeof(implementations) / sizeof(implementations[0]); i++) {
+			// The second pass only runs what the options change
+			if (pass > 0 && options.key(implementations[i]) == plain.key(implementations[i])) {
+				continue;
+			}
+
+			Ped::Model model;
+			ParseScenario parser(scenefile, model);
+			model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementations[i]);
+			options.apply(model, implementations[i]);
+			for (int tick = 0; tick < warmupTicks; tick++) {
+				model.tick();
+			}
+
+			long long before = AllocationCounter::count();
+			for (int tick = 0; tick < checkedTicks; tick++) {
+				model.tick();
+			}
+			long long allocations = AllocationCounter::count() - before;
+
+			cout << names[i] << " (" << options.key(implementations[i]).toStdString() << "): " << allocations << " allocations in " << checkedTicks << " ticks" << endl;
+			if (allocations != 0) {
+				allocationFree = false;
+			}
+		}
+	}
+	return allocationFree;
+}
+
 int main(int argc, char*argv[]) {
 	bool timing_mode = 0;
+	bool alloc_check = false;
+	bool autotune = false;
+	// Benchmark trials after the timing run; none unless --trials=N
+	int trials = 0;
+	bool save_baseline = false;
+	bool perf_counters = false;
+	ModelOptions options;
+	int metrics_port = 0;
+	int serve_port = 0;
+	const char *export_name = NULL;
 	int i = 1;
 	QString scenefile = "scenario.xml";
 	//QString scenefile = "scenario_box.xml";
@@ -56,50 +142,102 @@ int main(int argc, char*argv[]) {
 				cout << "Timing mode on\n";
 				timing_mode = true;
 			}
-			if (strcmp(&argv[i][2], "openmp") == 0)
+			else if (strncmp(&argv[i][2], "blur=", 5) == 0)
+			{
+				options.blur = atoi(&argv[i][7]);
+			}
+			else if (strcmp(&argv[i][2], "autotune") == 0)
+			{
+				autotune = true;
+			}
+			else if (strncmp(&argv[i][2], "trials=", 7) == 0)
+			{
+				trials = atoi(&argv[i][9]);
+			}
+			else if (strncmp(&argv[i][2], "export=", 7) == 0)
+			{
+				export_name = &argv[i][9];
+			}
+			else if (strncmp(&argv[i][2], "serve=", 6) == 0)
+			{
+				serve_port = atoi(&argv[i][8]);
+			}
+			else if (strncmp(&argv[i][2], "metrics-port=", 13) == 0)
+			{
+				metrics_port = atoi(&argv[i][15]);
+			}
+			else if (strcmp(&argv[i][2], "perf-counters") == 0)
+			{
+				perf_counters = true;
+			}
+			else if (strcmp(&argv[i][2], "level-of-detail") == 0)
+			{
+				options.levelOfDetail = true;
+			}
+			else if (strcmp(&argv[i][2], "hybrid") == 0)
+			{
+				options.hybrid = true;
+			}
+			else if (strcmp(&argv[i][2], "save-baseline") == 0)
+			{
+				save_baseline = true;
+			}
+			else if (strcmp(&argv[i][2], "alloc-check") == 0)
+			{
+				alloc_check = true;
+			}
+			else if (strcmp(&argv[i][2], "openmp") == 0)
 			{
 				cout << "openMP arg parsing\n";
 				mode = 2;
 			}
-			if (strcmp(&argv[i][2], "pthread") == 0)
+			else if (strcmp(&argv[i][2], "pthread") == 0)
 			{
 				mode = 3;
 			}
-			if (strcmp(&argv[i][2], "vector") == 0)
+			else if (strcmp(&argv[i][2], "vector") == 0)
 			{
 				mode = 4;
 			}
-			if (strcmp(&argv[i][2], "vectoromp") == 0)
+			else if (strcmp(&argv[i][2], "vectoromp") == 0)
 			{
 				mode = 5;
 			}
-			if (strcmp(&argv[i][2], "cuda") == 0)
+			else if (strcmp(&argv[i][2], "cuda") == 0)
 			{
 				mode = 6;
 			}
-			if (strcmp(&argv[i][2], "nocollisionseq") == 0)
+			else if (strcmp(&argv[i][2], "nocollisionseq") == 0)
 			{
 				mode = 7;
 			}
-			if (strcmp(&argv[i][2], "nocollisionregion") == 0)
+			else if (strcmp(&argv[i][2], "nocollisionregion") == 0)
 			{
 				mode = 8;
 			}
-			if (strcmp(&argv[i][2], "nocollisionseqomp") == 0)
+			else if (strcmp(&argv[i][2], "nocollisionseqomp") == 0)
 			{
 				mode = 9;
 			}
-			if (strcmp(&argv[i][2], "heatmapseq") == 0)
+			else if (strcmp(&argv[i][2], "heatmapseq") == 0)
 			{
 				mode = 10;
 			}
-			if (strcmp(&argv[i][2], "heatmapparallel") == 0)
+			else if (strcmp(&argv[i][2], "intstep") == 0)
+			{
+				mode = 12;
+			}
+			else if (strcmp(&argv[i][2], "flowfield") == 0)
+			{
+				mode = 13;
+			}
+			else if (strcmp(&argv[i][2], "heatmapparallel") == 0)
 			{
 				mode = 11;
 			}
 			else if (strcmp(&argv[i][2], "help") == 0)
 			{
-				cout << "Usage: " << argv[0] << " [--help] [--timing-mode] [scenario]" << endl;
+				cout << "Usage: " << argv[0] << " [--help] [--timing-mode] [--alloc-check] [--blur=3|5|7] [--autotune] [--trials=N] [--save-baseline] [--perf-counters] [--level-of-detail] [--hybrid] [--intstep] [--flowfield] [--metrics-port=N] [--serve=PORT] [--export=NAME] [scenario]" << endl;
 				return 0;
 			}
 			else
@@ -114,13 +252,91 @@ int main(int argc, char*argv[]) {
 
 		i += 1;
 	}
+	if (alloc_check)
+	{
+		return checkTickAllocations(scenefile) ? 0 : 1;
+	}
+
 	int retval = 0;
 	{ // This scope is for the purpose of removing false memory leak positives
 
+	  // With --metrics-port the model that runs reports live metrics,
+	  // served over HTTP from a background thread
+		Ped::Tmetrics metrics;
+		MetricsServer metricsServer(metrics);
+		Ped::Tmetrics *liveMetrics = NULL;
+		if (metrics_port > 0 && metricsServer.start(metrics_port))
+		{
+			liveMetrics = &metrics;
+		}
+
+	  // With --autotune the fastest thread count for the heatmap backend
+	  // is measured (or taken from the cache)
+		AutoTuner::Choice guiChoice = { Ped::HEATMAP_SEQ, 0 };
+		if (autotune && !timing_mode)
+		{
+			guiChoice = AutoTuner(scenefile).choose(AutoTuner::HEATMAP);
+			cout << "Auto-tuned: " << AutoTuner::name(guiChoice.implementation) << " with " << guiChoice.threads << " threads" << endl;
+		}
+
 	  // Reading the scenario file and setting up the crowd simulation model
 		Ped::Model model;
-		ParseScenario parser(scenefile);
-		model.setup(parser.getAgents(), parser.getWaypoints(), Ped::HEATMAP_SEQ);
+		ParseScenario parser(scenefile, model);
+		model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), guiChoice.implementation);
+		model.setNumThreads(guiChoice.threads);
+		model.setMetrics(liveMetrics);
+		if (!options.apply(model, guiChoice.implementation))
+		{
+			cerr << "Unsupported blur size " << options.blur << ", using 5" << endl;
+			options.blur = 5;
+		}
+
+		// With --export the agents and the heatmap are published to the
+		// shared memory segment NAME after every tick
+		std::unique_ptr<Ped::Texport> exporter;
+		if (export_name != NULL)
+		{
+			exporter.reset(new Ped::Texport(export_name, model));
+			if (exporter->isOpen())
+			{
+				model.setExport(exporter.get());
+			}
+		}
+
+		// Headless server: no window; frames are streamed to remote
+		// viewers until the process is interrupted. Ticks are paced to
+		// SERVE_TICKS_PER_SECOND rather than run flat out.
+		if (serve_port > 0)
+		{
+			FrameServer frameServer(model);
+			if (!frameServer.start(serve_port))
+			{
+				return 1;
+			}
+			std::signal(SIGINT, requestStop);
+			std::signal(SIGTERM, requestStop);
+
+			const std::chrono::steady_clock::duration tickPeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / SERVE_TICKS_PER_SECOND));
+			std::chrono::steady_clock::time_point nextTick = std::chrono::steady_clock::now();
+			while (!stopServing)
+			{
+				model.tick();
+				frameServer.publish();
+
+				// A tick that ran late starts the next one right away,
+				// without trying to catch up
+				nextTick += tickPeriod;
+				const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				if (nextTick < now)
+				{
+					nextTick = now;
+				}
+				std::this_thread::sleep_until(nextTick);
+			}
+			frameServer.stop();
+			cout << "Server stopped" << endl;
+			return 0;
+		}
 
 		// GUI related set ups
 		QApplication app(argc, argv);
@@ -141,8 +357,8 @@ int main(int argc, char*argv[]) {
 			double fps_seq, fps_target;
 			{
 				Ped::Model model;
-				ParseScenario parser(scenefile);
-				model.setup(parser.getAgents(), parser.getWaypoints(), Ped::SEQCOLLISION);
+				ParseScenario parser(scenefile, model);
+				model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), Ped::SEQCOLLISION);
 				PedSimulation simulation(model, mainwindow);
 				// Simulation mode to use when profiling (without any GUI)
 				std::cout << "Running reference version SEQCOLLISION...\n";
@@ -153,7 +369,41 @@ int main(int argc, char*argv[]) {
 				cout << "Reference time: " << duration_seq.count() << " milliseconds, " << fps_seq << " Frames Per Second." << std::endl;
 			}
 			Ped::IMPLEMENTATION implementation_to_test;
-			switch (mode)
+			int threads_to_test = 0;
+			if (autotune)
+			{
+				// Tune among the backends that do what the selected mode does
+				AutoTuner::Family family = AutoTuner::WALKING;
+				if (mode == 7 || mode == 8 || mode == 9)
+				{
+					family = AutoTuner::COLLISION;
+				}
+				else if (mode == 10)
+				{
+					family = AutoTuner::HEATMAP;
+				}
+				AutoTuner::Choice choice = AutoTuner(scenefile).choose(family);
+				implementation_to_test = choice.implementation;
+				threads_to_test = choice.threads;
+				{
+					Ped::Model model;
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
+					model.setNumThreads(choice.threads);
+					PedSimulation simulation(model, mainwindow);
+					// Simulation mode to use when profiling (without any GUI)
+					std::cout << "Running auto-tuned version " << AutoTuner::name(implementation_to_test) << " with " << choice.threads << " threads...\n";
+					auto start = std::chrono::steady_clock::now();
+					simulation.runSimulationWithoutQt(maxNumberOfStepsToSimulate);
+					auto duration_target = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now() - start);
+					fps_target = ((float)simulation.getTickCount()) / ((float)duration_target.count())*1000.0;
+					cout << "Target time: " << duration_target.count() << " milliseconds, " << fps_target << " Frames Per Second." << std::endl;
+					std::cout << "\n\nSpeedup for Seq Vs auto-tuned: " << fps_target / fps_seq << std::endl;
+				}
+			}
+			else switch (mode)
 			{
 			case 2:
 				// Change this variable when testing different versions of your code. 
@@ -161,8 +411,10 @@ int main(int argc, char*argv[]) {
 				implementation_to_test = Ped::OMP;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version OPENMP...\n";
@@ -180,8 +432,10 @@ int main(int argc, char*argv[]) {
 				implementation_to_test = Ped::PTHREAD;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version PThread...\n";
@@ -199,8 +453,10 @@ int main(int argc, char*argv[]) {
 				implementation_to_test = Ped::VECTOR;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version VECTOR...\n";
@@ -218,8 +474,10 @@ int main(int argc, char*argv[]) {
 				implementation_to_test = Ped::VECTOROMP;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version VECTOROMP...\n";
@@ -237,8 +495,10 @@ int main(int argc, char*argv[]) {
 				implementation_to_test = Ped::CUDA;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version CUDA...\n";
@@ -256,8 +516,10 @@ int main(int argc, char*argv[]) {
 				implementation_to_test = Ped::SEQCOLLISION;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version SEQCOLLISION...\n";
@@ -275,8 +537,10 @@ int main(int argc, char*argv[]) {
 				implementation_to_test = Ped::REGION;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version REGION...\n";
@@ -294,8 +558,10 @@ int main(int argc, char*argv[]) {
 				implementation_to_test = Ped::SEQCOLLISIONOMP;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version SEQCOLLISIONOMP...\n";
@@ -313,8 +579,10 @@ int main(int argc, char*argv[]) {
 				implementation_to_test = Ped::HEATMAP_SEQ;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version SEQCOLLISIONOMP...\n";
@@ -326,12 +594,52 @@ int main(int argc, char*argv[]) {
 					std::cout << "\n\nSpeedup for Seq Vs HEATMApSEQ: " << fps_target / fps_seq << std::endl;
 				}
 				break;
+			case 12:
+				implementation_to_test = Ped::INTSTEP;
+				{
+					Ped::Model model;
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
+					PedSimulation simulation(model, mainwindow);
+					// Simulation mode to use when profiling (without any GUI)
+					std::cout << "Running target version INTSTEP...\n";
+					auto start = std::chrono::steady_clock::now();
+					simulation.runSimulationWithoutQt(maxNumberOfStepsToSimulate);
+					auto duration_target = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now() - start);
+					fps_target = ((float)simulation.getTickCount()) / ((float)duration_target.count())*1000.0;
+					cout << "Target time: " << duration_target.count() << " milliseconds, " << fps_target << " Frames Per Second." << std::endl;
+					std::cout << "\n\nSpeedup for Seq Vs INTSTEP: " << fps_target / fps_seq << std::endl;
+				}
+				break;
+			case 13:
+				implementation_to_test = Ped::FLOWFIELD;
+				{
+					Ped::Model model;
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
+					PedSimulation simulation(model, mainwindow);
+					// Simulation mode to use when profiling (without any GUI)
+					std::cout << "Running target version FLOWFIELD...\n";
+					auto start = std::chrono::steady_clock::now();
+					simulation.runSimulationWithoutQt(maxNumberOfStepsToSimulate);
+					auto duration_target = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now() - start);
+					fps_target = ((float)simulation.getTickCount()) / ((float)duration_target.count())*1000.0;
+					cout << "Target time: " << duration_target.count() << " milliseconds, " << fps_target << " Frames Per Second." << std::endl;
+					std::cout << "\n\nSpeedup for Seq Vs FLOWFIELD: " << fps_target / fps_seq << std::endl;
+				}
+				break;
 			default: // code to be executed if n doesn't match any cases
 				implementation_to_test = Ped::SEQ;
 				{
 					Ped::Model model;
-					ParseScenario parser(scenefile);
-					model.setup(parser.getAgents(), parser.getWaypoints(), implementation_to_test);
+					ParseScenario parser(scenefile, model);
+					model.setup(parser.getAgents(), parser.getWaypoints(), parser.getObstacles(), parser.getSources(), parser.getSinks(), implementation_to_test);
+					model.setMetrics(liveMetrics);
+					options.apply(model, implementation_to_test);
 					PedSimulation simulation(model, mainwindow);
 					// Simulation mode to use when profiling (without any GUI)
 					std::cout << "Running target version SEQ...\n";
@@ -344,6 +652,20 @@ int main(int argc, char*argv[]) {
 				}
 			}
 
+			// With --trials=N, N repeated trials of the tested version are
+			// kept in the results file and compared with its stored baseline
+			if (trials > 0)
+			{
+				BenchmarkStore benchmarks(scenefile);
+				std::cout << "\nRunning " << trials << " trials of " << AutoTuner::name(implementation_to_test) << "...\n";
+				BenchmarkStore::Run run = benchmarks.measure(implementation_to_test, threads_to_test, options, trials, maxNumberOfStepsToSimulate, perf_counters);
+				benchmarks.store(run, save_baseline);
+				if (!save_baseline && !benchmarks.compare(run))
+				{
+					retval = 2;
+				}
+			}
+
 
 
 
@@ -363,6 +685,7 @@ int main(int argc, char*argv[]) {
 			mainwindow.show();
 			simulation.runSimulationWithQt(maxNumberOfStepsToSimulate);
 			retval = app.exec();
+			simulation.stop();
 
 			auto duration = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now() - start);
 			float fps = ((float)simulation.getTickCount()) / ((float)duration.count())*1000.0;
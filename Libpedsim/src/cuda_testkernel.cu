@@ -41,7 +41,7 @@ __global__ void updateHeatmapKernel(int *heatmap, int size, int *desiredX, int *
 {
 	int idx = blockDim.x * blockIdx.x + threadIdx.x;
 
-	if (idx > agents) return;
+	if (idx >= agents) return;
 	if (desiredX[idx] < 0 || desiredX[idx] >= size || desiredY[idx] < 0 || desiredY[idx] >= size)
 	{
 		return;
@@ -87,14 +87,8 @@ __global__ void blurHeatmapKernel(int *heatmap, int *blurred_heatmap, int size,
 	}
 	// synchronize threads
 	__syncthreads();
-	const int w[5][5] = {
-		{ 1, 4, 7, 4, 1 },
-	{ 4, 16, 26, 16, 4 },
-	{ 7, 26, 41, 26, 7 },
-	{ 4, 16, 26, 16, 4 },
-	{ 1, 4, 7, 4, 1 }
-	};
-	#define WEIGHTSUM 273
+	// The 5x5 binomial kernel of ped_blur.h: the weights sum to 2^8
+	const int w[5] = { 1, 4, 6, 4, 1 };
 	// every thread calculates 25 values of the scaled heatmap
 	// first row 
 	if ((thread_id != 0) & (thread_id != 1023)) {
@@ -104,10 +98,10 @@ __global__ void blurHeatmapKernel(int *heatmap, int *blurred_heatmap, int size,
 			for (int k = -2; k < 3; k++) {
 				for (int l = -2; l < 3; l++) {
 					index = (int)((thread_id * 5 + i + k) / 5);
-					sum += hm_s[index] * w[2 + k][2 + l];
+					sum += hm_s[index] * w[2 + k] * w[2 + l];
 				}
 			}
-			int value = sum / WEIGHTSUM;
+			int value = sum >> 8;
 			blurred_heatmap[thread_id * 5 + i + (row * 5 * SCALED_SIZE)] = 0x00FF0000 | value << 24;
 		}
 		for (int j = 2; j < 6; j++) {
@@ -117,10 +111,10 @@ __global__ void blurHeatmapKernel(int *heatmap, int *blurred_heatmap, int size,
 				for (int k = -2; k < 3; k++) {
 					for (int l = -2; l < 3; l++) {
 						index = (int)((thread_id * 5 + i + k) / 5) + SIZE * (int)((j + l) / 4);
-						sum += hm_s[index] * w[2 + k][2 + l];
+						sum += hm_s[index] * w[2 + k] * w[2 + l];
 					}
 				}
-				int value = sum / WEIGHTSUM;
+				int value = sum >> 8;
 				blurred_heatmap[thread_id * 5 + i + (((row * 5) + j - 1)* SCALED_SIZE)] = 0x00FF0000 | value << 24;
 			}
 		}
@@ -128,44 +122,93 @@ __global__ void blurHeatmapKernel(int *heatmap, int *blurred_heatmap, int size,
 
 }
 
+// Device buffers, kept from one tick to the next so that a tick never
+// allocates. They are shared by every model on the GPU backends:
+// cuda_setupHeatmap counts a model in and allocates the heatmaps for
+// the first one, the agent arrays grow to the largest agent count
+// seen, and cuda_release frees everything once the last model is gone.
+static int deviceUsers = 0;
+static int *dev_heatmap = 0;
+static int *dev_scaled_heatmap = 0;
+static int *dev_blurred_heatmap = 0;
+static int *dev_heatmapDesiredX = 0;
+static int *dev_heatmapDesiredY = 0;
+static int heatmapAgentCapacity = 0;
+
+static int *dev_x = 0;
+static int *dev_y = 0;
+static float *dev_destinationX = 0;
+static float *dev_destinationY = 0;
+static int *dev_desiredX = 0;
+static int *dev_desiredY = 0;
+static unsigned int tickAgentCapacity = 0;
+
 void cuda_setupHeatmap(int *heatmap, int *scaled_heatmap, int *blurred_heatmap)
 {
 	const int size = 1024;
 	const int cell_size = 5;
 	cudaError_t cudaStatus;
 	cudaStatus = cudaSetDevice(0);
-	cudaStatus = cudaHostAlloc(&heatmap, size * size * sizeof(int), cudaHostAllocDefault);
-	if (cudaStatus != cudaSuccess)
-		printf("Error allocating pinned host memory\n");
-	cudaStatus = cudaHostAlloc(&scaled_heatmap, size * cell_size * size * cell_size * sizeof(int), cudaHostAllocDefault);
-	if (cudaStatus != cudaSuccess)
-		printf("Error allocating pinned host memory\n");
-	cudaStatus = cudaHostAlloc(&blurred_heatmap, size * cell_size * size * cell_size * sizeof(int), cudaHostAllocDefault);
-	if (cudaStatus != cudaSuccess)
-		printf("Error allocating pinned host memory\n");
+	deviceUsers++;
+	if (dev_heatmap == 0) {
+		cudaStatus = cudaMalloc(&dev_heatmap, size * size * sizeof(int));
+		cudaStatus = cudaMalloc(&dev_scaled_heatmap, size * cell_size * size * cell_size * sizeof(int));
+		cudaStatus = cudaMalloc(&dev_blurred_heatmap, size * cell_size * size * cell_size * sizeof(int));
+		if (cudaStatus != cudaSuccess)
+			printf("Error allocating device memory for the heatmap\n");
+	}
+}
+
+void cuda_release()
+{
+	if (deviceUsers == 0 || --deviceUsers > 0) {
+		return;
+	}
+	cudaFree(dev_heatmap);
+	cudaFree(dev_scaled_heatmap);
+	cudaFree(dev_blurred_heatmap);
+	cudaFree(dev_heatmapDesiredX);
+	cudaFree(dev_heatmapDesiredY);
+	dev_heatmap = dev_scaled_heatmap = dev_blurred_heatmap = dev_heatmapDesiredX = dev_heatmapDesiredY = 0;
+	heatmapAgentCapacity = 0;
+
+	cudaFree(dev_x);
+	cudaFree(dev_y);
+	cudaFree(dev_destinationX);
+	cudaFree(dev_destinationY);
+	cudaFree(dev_desiredX);
+	cudaFree(dev_desiredY);
+	dev_x = dev_y = dev_desiredX = dev_desiredY = 0;
+	dev_destinationX = dev_destinationY = 0;
+	tickAgentCapacity = 0;
 }
 
 cudaError_t createHeatmapWithCuda(Ped::Model *model, int *heatmap, int *scaled_heatmap, int *blurred_heatmap, const int size, const int cell_size, int *desiredX, int *desiredY, const int agents)
 {
-	int *dev_heatmap = 0;
-	int *dev_scaled_heatmap = 0;
-	int *dev_blurred_heatmap = 0;
-	int *dev_desiredX = 0;
-	int *dev_desiredY = 0;
+	// Nothing to draw on unless cuda_setupHeatmap counted a model in
+	if (dev_heatmap == 0) {
+		return cudaErrorInvalidValue;
+	}
+
 	cudaError_t cudaStatus;
 	cudaStatus = cudaSetDevice(0);
 
-	cudaStatus = cudaMalloc(&dev_heatmap, size * size * sizeof(int));
-	cudaStatus = cudaMalloc(&dev_scaled_heatmap, size * cell_size * size * cell_size * sizeof(int));
-	cudaStatus = cudaMalloc(&dev_blurred_heatmap, size * cell_size * size * cell_size * sizeof(int));
-	cudaStatus = cudaMalloc(&dev_desiredX, size * sizeof(int));
-	cudaStatus = cudaMalloc(&dev_desiredY, size * sizeof(int));
+	// Only a larger crowd than ever before needs new agent buffers
+	if (agents > heatmapAgentCapacity) {
+		cudaFree(dev_heatmapDesiredX);
+		cudaFree(dev_heatmapDesiredY);
+		cudaStatus = cudaMalloc(&dev_heatmapDesiredX, agents * sizeof(int));
+		cudaStatus = cudaMalloc(&dev_heatmapDesiredY, agents * sizeof(int));
+		heatmapAgentCapacity = agents;
+	}
+	int *dev_desiredX = dev_heatmapDesiredX;
+	int *dev_desiredY = dev_heatmapDesiredY;
 
 	cudaStatus = cudaMemcpyAsync(dev_heatmap, heatmap, size * size * sizeof(int), cudaMemcpyHostToDevice);
 	cudaStatus = cudaMemcpyAsync(dev_scaled_heatmap, scaled_heatmap, size * cell_size * size * cell_size * sizeof(int), cudaMemcpyHostToDevice);
 	cudaStatus = cudaMemcpyAsync(dev_blurred_heatmap, blurred_heatmap, size * cell_size * size * cell_size * sizeof(int), cudaMemcpyHostToDevice);
-	cudaStatus = cudaMemcpyAsync(dev_desiredX, desiredX, size * sizeof(int), cudaMemcpyHostToDevice); // Not pinned.
-	cudaStatus = cudaMemcpyAsync(dev_desiredY, desiredY, size * sizeof(int), cudaMemcpyHostToDevice); // Not pinned.
+	cudaStatus = cudaMemcpyAsync(dev_desiredX, desiredX, agents * sizeof(int), cudaMemcpyHostToDevice); // Not pinned.
+	cudaStatus = cudaMemcpyAsync(dev_desiredY, desiredY, agents * sizeof(int), cudaMemcpyHostToDevice); // Not pinned.
 	
 	dim3 grid(1024, 5, 5);
 	dim3 block(1024, 1, 1);
@@ -191,7 +234,10 @@ cudaError_t createHeatmapWithCuda(Ped::Model *model, int *heatmap, int *scaled_h
 	cudaEventCreate(&stop_update_event);
 	cudaEventRecord(start_update_event, 0);
 
-	updateHeatmapKernel << < 1, 1024 >> > (dev_heatmap, size, dev_desiredX, dev_desiredY, agents);
+	// One thread per agent, in as many blocks as that takes
+	if (agents > 0) {
+		updateHeatmapKernel << < (agents + 1023) / 1024, 1024 >> > (dev_heatmap, size, dev_desiredX, dev_desiredY, agents);
+	}
 	
 	cudaEventRecord(stop_update_event, 0);
 	cudaEventSynchronize(stop_update_event);
@@ -239,11 +285,6 @@ cudaError_t createHeatmapWithCuda(Ped::Model *model, int *heatmap, int *scaled_h
 
 	//cudaStatus = cudaDeviceSynchronize();
 	cudaDeviceSynchronize();
-	cudaFree(dev_heatmap);
-	cudaFree(dev_scaled_heatmap);
-	cudaFree(dev_blurred_heatmap);
-	cudaFree(dev_desiredX);
-	cudaFree(dev_desiredY);
 
 	/*cudaFreeHost(heatmap);
 	cudaFreeHost(scaled_heatmap);
@@ -296,13 +337,8 @@ Tuple cuda_tick(const int *x, const int *y, const float *destinationX, const flo
 	//	//return 1;
 	//}
 
-	// cudaDeviceReset must be called before exiting in order for profiling and
-	// tracing tools such as Nsight and Visual Profiler to show complete traces.
-	cudaStatus = cudaDeviceReset();
-	//if (cudaStatus != cudaSuccess) {
-	//	fprintf(stderr, "cudaDeviceReset failed!");
-	//	//return 1;
-	//}
+	// The device is reset by cuda_release, not here: that would free
+	// the buffers the next tick reuses
 
 	Tuple r = { desiredX, desiredY };
 	return r;
@@ -310,59 +346,65 @@ Tuple cuda_tick(const int *x, const int *y, const float *destinationX, const flo
 
 cudaError_t computeNextPositionWithCuda(const int *x, const int *y, const float *destinationX, const float *destinationY, unsigned int size, int *desiredX, int *desiredY)
 {
-	int *dev_x = 0;
-	int *dev_y = 0;
-	float *dev_destinationX = 0;
-	float *dev_destinationY = 0;
-	int *dev_desiredX = 0;
-	int *dev_desiredY = 0;
 	cudaError_t cudaStatus;
 
 	// Choose which GPU to run on, change this on a multi-GPU system.
 	cudaStatus = cudaSetDevice(0);
+
+	// The buffers of the previous tick are reused unless there are more agents now
+	if (size > tickAgentCapacity) {
+		cudaFree(dev_x);
+		cudaFree(dev_y);
+		cudaFree(dev_destinationX);
+		cudaFree(dev_destinationY);
+		cudaFree(dev_desiredX);
+		cudaFree(dev_desiredY);
 	/*if (cudaStatus != cudaSuccess) {
 	fprintf(stderr, "cudaSetDevice failed!  Do you have a CUDA-capable GPU installed?");
 	fprintf(stderr, "%s.\n", cudaGetErrorString(cudaGetLastError()));
 	goto Error;
 	}*/
 
-	// Allocate GPU buffers for three vectors (two input, one output)    .
-	cudaStatus = cudaMalloc((void**)&dev_x, size * sizeof(int));
-	/*if (cudaStatus != cudaSuccess) {
-	fprintf(stderr, "cudaMalloc failed!");
-	goto Error;
-	}*/
+		// Allocate GPU buffers for three vectors (two input, one output)    .
+		cudaStatus = cudaMalloc((void**)&dev_x, size * sizeof(int));
+		/*if (cudaStatus != cudaSuccess) {
+		fprintf(stderr, "cudaMalloc failed!");
+		goto Error;
+		}*/
 
-	cudaStatus = cudaMalloc((void**)&dev_y, size * sizeof(int));
-	/*if (cudaStatus != cudaSuccess) {
-	fprintf(stderr, "cudaMalloc failed!");
-	goto Error;
-	}*/
+		cudaStatus = cudaMalloc((void**)&dev_y, size * sizeof(int));
+		/*if (cudaStatus != cudaSuccess) {
+		fprintf(stderr, "cudaMalloc failed!");
+		goto Error;
+		}*/
 
-	cudaStatus = cudaMalloc((void**)&dev_destinationX, size * sizeof(float));
-	/*if (cudaStatus != cudaSuccess) {
-	fprintf(stderr, "cudaMalloc failed!");
-	goto Error;
-	}*/
+		cudaStatus = cudaMalloc((void**)&dev_destinationX, size * sizeof(float));
+		/*if (cudaStatus != cudaSuccess) {
+		fprintf(stderr, "cudaMalloc failed!");
+		goto Error;
+		}*/
 
-	cudaStatus = cudaMalloc((void**)&dev_destinationY, size * sizeof(float));
-	/*if (cudaStatus != cudaSuccess) {
-	fprintf(stderr, "cudaMalloc failed!");
-	goto Error;
-	}
-	*/
-	cudaStatus = cudaMalloc((void**)&dev_desiredX, size * sizeof(int));
-	/*if (cudaStatus != cudaSuccess) {
-	fprintf(stderr, "cudaMalloc failed!");
-	goto Error;
-	}
-	*/
-	cudaStatus = cudaMalloc((void**)&dev_desiredY, size * sizeof(int));
-	/*if (cudaStatus != cudaSuccess) {
-	fprintf(stderr, "cudaMalloc failed!");
-	goto Error;
+		cudaStatus = cudaMalloc((void**)&dev_destinationY, size * sizeof(float));
+		/*if (cudaStatus != cudaSuccess) {
+		fprintf(stderr, "cudaMalloc failed!");
+		goto Error;
+		}
+		*/
+		cudaStatus = cudaMalloc((void**)&dev_desiredX, size * sizeof(int));
+		/*if (cudaStatus != cudaSuccess) {
+		fprintf(stderr, "cudaMalloc failed!");
+		goto Error;
+		}
+		*/
+		cudaStatus = cudaMalloc((void**)&dev_desiredY, size * sizeof(int));
+		/*if (cudaStatus != cudaSuccess) {
+		fprintf(stderr, "cudaMalloc failed!");
+		goto Error;
+		}
+		*/
+		tickAgentCapacity = size;
 	}
-	*/
+
 	// Copy input vectors from host memory to GPU buffers.
 	cudaStatus = cudaMemcpy(dev_x, x, size * sizeof(int), cudaMemcpyHostToDevice);
 	/*if (cudaStatus != cudaSuccess) {
@@ -433,12 +475,6 @@ cudaError_t computeNextPositionWithCuda(const int *x, const int *y, const float
 	}*/
 
 	//Error:
-	cudaFree(dev_x);
-	cudaFree(dev_y);
-	cudaFree(dev_destinationX);
-	cudaFree(dev_destinationY);
-	cudaFree(dev_desiredX);
-	cudaFree(dev_desiredY);
 	//if (cudaStatus != 0) {
 	//	fprintf(stderr, "Cuda does not seem to be working properly.\n"); // This is not a good thing
 	//}
@@ -7,6 +7,11 @@ struct Tuple {
 };
 
 int cuda_test();
+// Counts a model in to the device buffers, allocating them for the first
 void cuda_setupHeatmap(int *heatmap, int *scaled_heatmap, int *blurred_heatmap);
+
+// Counts a model out; the last one frees the device buffers the heatmap
+// and cuda_tick keep between ticks
+void cuda_release();
 void cuda_updateHeatmap(Ped::Model *model, int *heatmap, int *scaled_heatmap, int *blurred_heatmap, int size, int cell_size, int *desiredX, int *desiredY, int agents);
 Tuple cuda_tick(const int *x, const int *y, const float *destinationX, const float *destinationY, int *desiredX, int *desiredY, int size);
\ No newline at end of file
@@ -7,6 +7,7 @@
 
 #include <cstdlib>
 #include <iostream>
+#include <algorithm>
 using namespace std;
 
 // Memory leak check with msvc++
@@ -21,39 +22,88 @@ using namespace std;
 void Ped::Model::setupHeatmapSeq()
 {
 	int *hm = (int*)calloc(SIZE*SIZE, sizeof(int));
-	int *shm = (int*)malloc(SCALED_SIZE*SCALED_SIZE * sizeof(int));
+	int *phm = (int*)calloc(SIZE*SIZE, sizeof(int));
+	int *shm = (int*)calloc(SCALED_SIZE*SCALED_SIZE, sizeof(int));
 	int *bhm = (int*)malloc(SCALED_SIZE*SCALED_SIZE * sizeof(int));
 
+	// An empty heatmap blurs to fully transparent everywhere
+	for (int i = 0; i < SCALED_SIZE*SCALED_SIZE; i++)
+	{
+		bhm[i] = 0x00FF0000;
+	}
+
 	heatmap = (int**)malloc(SIZE * sizeof(int*));
+	published_heatmap = (int**)malloc(SIZE * sizeof(int*));
 
 	scaled_heatmap = (int**)malloc(SCALED_SIZE * sizeof(int*));
-	scaled_heatmap1 = (int**)malloc(SCALED_SIZE * sizeof(int*));
 	blurred_heatmap = (int**)malloc(SCALED_SIZE * sizeof(int*));
 
 	for (int i = 0; i < SIZE; i++)
 	{
 		heatmap[i] = hm + SIZE * i;
+		published_heatmap[i] = phm + SIZE * i;
 	}
 	for (int i = 0; i < SCALED_SIZE; i++)
 	{
 		scaled_heatmap[i] = shm + SCALED_SIZE * i;
-		scaled_heatmap1[i] = shm + SCALED_SIZE * i;
 		blurred_heatmap[i] = bhm + SCALED_SIZE * i;
 	}
 
-	cuda_setupHeatmap(*heatmap, *scaled_heatmap, *blurred_heatmap);
+	// At most every tile is dirty, so reporting never allocates during a tick
+	heatmapDirtyRects.reserve((SIZE / HEATMAP_TILE) * (SIZE / HEATMAP_TILE));
+	// Room for the largest rectangle a tile blurs, with the widest kernel
+	const int blurWidth = HEATMAP_TILE * CELLSIZE + 2 * BLUR_MAX_RADIUS;
+	blurScratch.assign(blurWidth * (blurWidth + 2 * BLUR_MAX_RADIUS), 0);
+
+	heatmapDesiredX.assign(agents.size(), 0);
+	heatmapDesiredY.assign(agents.size(), 0);
+
+	// Only the GPU backends need the device buffers, which are shared
+	// by all their models
+	if ((implementation == CPU_GPU || implementation == CUDA) && !usesDevice) {
+		cuda_setupHeatmap(*heatmap, *scaled_heatmap, *blurred_heatmap);
+		usesDevice = true;
+	}
 }
 
 void Ped::Model::updateHeatmapCUDA(Model *model)
 {
-	int *desiredX = (int*)malloc(agents.size() * sizeof(int));
-	int *desiredY = (int*)malloc(agents.size() * sizeof(int));
+	// Sized once; agents are only ever added by setup
+	if (heatmapDesiredX.size() != agents.size()) {
+		heatmapDesiredX.resize(agents.size());
+		heatmapDesiredY.resize(agents.size());
+	}
+	int *desiredX = heatmapDesiredX.data();
+	int *desiredY = heatmapDesiredY.data();
 	for (int i = 0; i < agents.size(); i++) {
-		desiredX[i] = agents[i]->getDesiredX();
-		desiredY[i] = agents[i]->getDesiredY();
+		// Free slots are placed outside the map, where the kernel skips them
+		desiredX[i] = agents[i]->isActive() ? agents[i]->getDesiredX() : -1;
+		desiredY[i] = agents[i]->isActive() ? agents[i]->getDesiredY() : -1;
 	}
 
 	cuda_updateHeatmap(model, *heatmap, *scaled_heatmap, *blurred_heatmap, 1024, 5, desiredX, desiredY, agents.size());
+
+	// The GPU redraws the whole heatmap every tick
+	HeatmapRect all = { 0, 0, SCALED_SIZE, SCALED_SIZE };
+	heatmapDirtyRects.push_back(all);
+}
+
+// True if a cell of the tile changed by more than HEATMAP_THRESHOLD
+// since the tile was last scaled and blurred.
+bool Ped::Model::heatmapTileChanged(int tileX, int tileY) const
+{
+	for (int y = tileY; y < tileY + HEATMAP_TILE; y++)
+	{
+		for (int x = tileX; x < tileX + HEATMAP_TILE; x++)
+		{
+			int diff = heatmap[y][x] - published_heatmap[y][x];
+			if (diff > HEATMAP_THRESHOLD || diff < -HEATMAP_THRESHOLD)
+			{
+				return true;
+			}
+		}
+	}
+	return false;
 }
 
 // Updates the heatmap according to the agent positions
@@ -72,6 +122,10 @@ void Ped::Model::updateHeatmapSeq()
 	for (int i = 0; i < agents.size(); i++)
 	{
 		Ped::Tagent* agent = agents[i];
+		if (!agent->isActive())
+		{
+			continue;
+		}
 		int x = agent->getDesiredX();
 		int y = agent->getDesiredY();
 
@@ -93,47 +147,153 @@ void Ped::Model::updateHeatmapSeq()
 		}
 	}
 
-	// Scale the data for visual representation
-	for (int y = 0; y < SIZE; y++)
+	// Only tiles that changed noticeably are scaled and blurred again
+	for (int tileY = 0; tileY < SIZE; tileY += HEATMAP_TILE)
 	{
-		for (int x = 0; x < SIZE; x++)
+		for (int tileX = 0; tileX < SIZE; tileX += HEATMAP_TILE)
 		{
-			int value = heatmap[y][x];
-			for (int cellY = 0; cellY < CELLSIZE; cellY++)
+			if (!heatmapRedrawAll && !heatmapTileChanged(tileX, tileY))
 			{
-				for (int cellX = 0; cellX < CELLSIZE; cellX++)
+				continue;
+			}
+
+			// Scale the data for visual representation
+			for (int y = tileY; y < tileY + HEATMAP_TILE; y++)
+			{
+				for (int x = tileX; x < tileX + HEATMAP_TILE; x++)
 				{
-					scaled_heatmap[y * CELLSIZE + cellY][x * CELLSIZE + cellX] = value;
+					int value = heatmap[y][x];
+					published_heatmap[y][x] = value;
+					for (int cellY = 0; cellY < CELLSIZE; cellY++)
+					{
+						for (int cellX = 0; cellX < CELLSIZE; cellX++)
+						{
+							scaled_heatmap[y * CELLSIZE + cellY][x * CELLSIZE + cellX] = value;
+						}
+					}
 				}
 			}
+
+			// The blur reaches blurRadius pixels into the neighboring tiles
+			int left = std::max(tileX * CELLSIZE - blurRadius, blurRadius);
+			int top = std::max(tileY * CELLSIZE - blurRadius, blurRadius);
+			int right = std::min((tileX + HEATMAP_TILE) * CELLSIZE + blurRadius, SCALED_SIZE - blurRadius);
+			int bottom = std::min((tileY + HEATMAP_TILE) * CELLSIZE + blurRadius, SCALED_SIZE - blurRadius);
+			HeatmapRect rect = { left, top, right - left, bottom - top };
+			heatmapDirtyRects.push_back(rect);
 		}
 	}
 
-	// Weights for blur filter
-	const int w[5][5] = {
-		{ 1, 4, 7, 4, 1 },
-	{ 4, 16, 26, 16, 4 },
-	{ 7, 26, 41, 26, 7 },
-	{ 4, 16, 26, 16, 4 },
-	{ 1, 4, 7, 4, 1 }
-	};
+	heatmapRedrawAll = false;
 
-#define WEIGHTSUM 273
-	// Apply gaussian blurfilter		       
-	for (int i = 2; i < SCALED_SIZE - 2; i++)
+	for (size_t i = 0; i < heatmapDirtyRects.size(); i++)
 	{
-		for (int j = 2; j < SCALED_SIZE - 2; j++)
+		blurHeatmapRect(heatmapDirtyRects[i]);
+	}
+}
+
+bool Ped::Model::setHeatmapBlur(int kernelSize)
+{
+	if (kernelSize != 3 && kernelSize != 5 && kernelSize != 7)
+	{
+		return false;
+	}
+	blurRadius = kernelSize / 2;
+	heatmapRedrawAll = true;
+	return true;
+}
+
+// Applies the gaussian blur filter to one rectangle of the scaled heatmap
+void Ped::Model::blurHeatmapRect(const HeatmapRect &rect)
+{
+	switch (blurRadius)
+	{
+	case 1:
+		blurHeatmapRectWith<1>(rect);
+		break;
+	case 3:
+		blurHeatmapRectWith<3>(rect);
+		break;
+	default:
+		blurHeatmapRectWith<2>(rect);
+		break;
+	}
+}
+
+// The separable blur, four pixels at a time: a horizontal pass over the
+// rectangle and the Radius rows above and below it into blurScratch,
+// then a vertical pass from there into blurred_heatmap
+template<int Radius>
+void Ped::Model::blurHeatmapRectWith(const HeatmapRect &rect)
+{
+	typedef Ped::TblurKernel<Radius> Kernel;
+	int w[Kernel::taps];
+	for (int k = 0; k < Kernel::taps; k++)
+	{
+		w[k] = Kernel::weight(k);
+	}
+
+	const int width = rect.width;
+	const int rows = rect.height + 2 * Radius;
+	if (blurScratch.size() < width * rows)
+	{
+		blurScratch.resize(width * rows);
+	}
+	int *scratch = blurScratch.data();
+
+	// Horizontal pass
+	for (int r = 0; r < rows; r++)
+	{
+		const int *source = scaled_heatmap[rect.y - Radius + r] + rect.x - Radius;
+		int *target = scratch + r * width;
+		int j = 0;
+		for (; j + 4 <= width; j += 4)
+		{
+			__m128i sum = _mm_setzero_si128();
+			for (int k = 0; k < Kernel::taps; k++)
+			{
+				__m128i pixels = _mm_loadu_si128((const __m128i *)(source + j + k));
+				sum = _mm_add_epi32(sum, _mm_mullo_epi32(pixels, _mm_set1_epi32(w[k])));
+			}
+			_mm_storeu_si128((__m128i *)(target + j), sum);
+		}
+		for (; j < width; j++)
 		{
 			int sum = 0;
-			for (int k = -2; k < 3; k++)
+			for (int k = 0; k < Kernel::taps; k++)
 			{
-				for (int l = -2; l < 3; l++)
-				{
-					sum += w[2 + k][2 + l] * scaled_heatmap[i + k][j + l];
-				}
+				sum += w[k] * source[j + k];
+			}
+			target[j] = sum;
+		}
+	}
+
+	// Vertical pass, normalized by a shift
+	const __m128i transparentRed = _mm_set1_epi32(0x00FF0000);
+	for (int i = 0; i < rect.height; i++)
+	{
+		int *target = blurred_heatmap[rect.y + i] + rect.x;
+		int j = 0;
+		for (; j + 4 <= width; j += 4)
+		{
+			__m128i sum = _mm_setzero_si128();
+			for (int k = 0; k < Kernel::taps; k++)
+			{
+				__m128i pixels = _mm_loadu_si128((const __m128i *)(scratch + (i + k) * width + j));
+				sum = _mm_add_epi32(sum, _mm_mullo_epi32(pixels, _mm_set1_epi32(w[k])));
+			}
+			__m128i value = _mm_srli_epi32(sum, Kernel::shift);
+			_mm_storeu_si128((__m128i *)(target + j), _mm_or_si128(transparentRed, _mm_slli_epi32(value, 24)));
+		}
+		for (; j < width; j++)
+		{
+			int sum = 0;
+			for (int k = 0; k < Kernel::taps; k++)
+			{
+				sum += w[k] * scratch[(i + k) * width + j];
 			}
-			int value = sum / WEIGHTSUM;
-			blurred_heatmap[i][j] = 0x00FF0000 | value << 24;
+			int value = sum >> Kernel::shift;
+			target[j] = 0x00FF0000 | value << 24;
 		}
 	}
 }
@@ -0,0 +1,298 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Implements the hybrid model, see Model::setHybrid. The density
+// blocks form a cell transmission model: every tick a block holding
+// n agents may send min(n / MACRO_BLOCK, MACRO_FLOW) of them towards
+// their destinations, and a density block with f free cells takes in
+// at most min(MACRO_FLOW, (f - n) / MACRO_BLOCK). A light block thus
+// empties at walking speed, while a full block ahead holds it back.
+// Within its block a carried agent steps onto the first of its
+// alternatives that is free, without any neighbor search.
+//
+#include "ped_model.h"
+
+#include <algorithm>
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+void Ped::Model::setHybrid(bool enabled)
+{
+	// The carried agents go back to the regions before the blocks go
+	for (int block = 0; block < macroAgents.size(); block++) {
+		if (macroDense[block]) {
+			releaseMacroBlock(block);
+		}
+	}
+
+	hybrid = enabled;
+	if (!enabled) {
+		macroDense.clear();
+		macroAgents.clear();
+		return;
+	}
+
+	macroBlocksPerSide = (WORLD_SIZE + MACRO_BLOCK - 1) / MACRO_BLOCK;
+	const int count = macroBlocksPerSide * macroBlocksPerSide;
+	macroDense.assign(count, 0);
+	macroFreeCells.assign(count, 0);
+	macroCredit.assign(count, 0);
+	macroReceive.assign(count, 0);
+	macroReceived.assign(count, 0);
+	for (int y = 0; y < WORLD_SIZE; y++) {
+		for (int x = 0; x < WORLD_SIZE; x++) {
+			if (!obstacleGrid.isBlocked(x, y)) {
+				macroFreeCells[macroBlockOf(x, y)]++;
+			}
+		}
+	}
+
+	// A block carries at most one agent per free cell, and takes in at
+	// most MACRO_FLOW per tick, so ticks never grow these
+	macroAgents = std::vector<std::vector<Tagent*> >(count);
+	for (int block = 0; block < count; block++) {
+		macroAgents[block].reserve(macroFreeCells[block]);
+	}
+	macroArrivals.reserve(count * MACRO_FLOW);
+}
+
+int Ped::Model::getMacroAgentCount() const
+{
+	int count = 0;
+	for (int block = 0; block < macroAgents.size(); block++) {
+		count += static_cast<int>(macroAgents[block].size());
+	}
+	return count;
+}
+
+int Ped::Model::macroBlockOf(int x, int y) const
+{
+	if (x < 0 || x >= WORLD_SIZE || y < 0 || y >= WORLD_SIZE) {
+		return -1;
+	}
+	return (y / MACRO_BLOCK) * macroBlocksPerSide + x / MACRO_BLOCK;
+}
+
+double Ped::Model::macroDensity(int block) const
+{
+	const int left = (block % macroBlocksPerSide) * MACRO_BLOCK;
+	const int top = (block / macroBlocksPerSide) * MACRO_BLOCK;
+	const int right = std::min(left + MACRO_BLOCK, WORLD_SIZE);
+	const int bottom = std::min(top + MACRO_BLOCK, WORLD_SIZE);
+	long heat = 0;
+	for (int y = top; y < bottom; y++) {
+		for (int x = left; x < right; x++) {
+			heat += heatmap[y][x];
+		}
+	}
+	return heat / ((double)macroFreeCells[block] * MACRO_HEAT);
+}
+
+void Ped::Model::updateHybrid()
+{
+	const int count = static_cast<int>(macroDense.size());
+
+	// Blocks change model at the tick boundary, going by the heat of
+	// the last tick
+	for (int block = 0; block < count; block++) {
+		if (macroFreeCells[block] == 0) {
+			continue;
+		}
+		const double density = macroDensity(block);
+		if (!macroDense[block] && density >= MACRO_ENTER) {
+			macroDense[block] = 1;
+		}
+		else if (macroDense[block] && density < MACRO_LEAVE) {
+			releaseMacroBlock(block);
+		}
+	}
+
+	// Agents that walked into a density block, or stood in one that just
+	// turned into a density, join it. The budgets go by the counts of
+	// the start of the tick.
+	for (int block = 0; block < count; block++) {
+		if (macroDense[block]) {
+			absorbMacroBlock(block);
+			const double carried = static_cast<double>(macroAgents[block].size());
+			macroCredit[block] = std::min(macroCredit[block] + std::min(carried / MACRO_BLOCK, (double)MACRO_FLOW), (double)MACRO_FLOW);
+			macroReceive[block] = std::min((double)MACRO_FLOW, (macroFreeCells[block] - carried) / MACRO_BLOCK);
+		}
+		else {
+			macroReceive[block] = MACRO_FLOW;
+		}
+		macroReceived[block] = 0;
+	}
+
+	// Agents that flow into another density block are only added to it
+	// afterwards, so that nobody moves twice in a tick
+	macroArrivals.clear();
+	for (int block = 0; block < count; block++) {
+		if (!macroDense[block]) {
+			continue;
+		}
+		std::vector<Tagent*> &carried = macroAgents[block];
+		size_t kept = 0;
+		for (size_t i = 0; i < carried.size(); i++) {
+			Ped::Tagent *agent = carried[i];
+			agent->computeNextDesiredPosition();
+			if (!moveMacroAgent(agent, block)) {
+				carried[kept++] = agent;
+			}
+		}
+		carried.resize(kept);
+	}
+	for (size_t i = 0; i < macroArrivals.size(); i++) {
+		macroAgents[macroArrivals[i].second].push_back(macroArrivals[i].first);
+	}
+}
+
+void Ped::Model::releaseMacroBlock(int block)
+{
+	// The carried agents stand on cells of the block, so they go back
+	// to the region the block lies in
+	std::vector<Tagent*> &carried = macroAgents[block];
+	for (size_t i = 0; i < carried.size(); i++) {
+		carried[i]->setMacroBlock(-1);
+		addToRegion(carried[i], regionOf(carried[i]->getX(), carried[i]->getY()));
+	}
+	carried.clear();
+	macroDense[block] = 0;
+	macroCredit[block] = 0;
+}
+
+void Ped::Model::absorbMacroBlock(int block)
+{
+	const int left = (block % macroBlocksPerSide) * MACRO_BLOCK;
+	const int top = (block / macroBlocksPerSide) * MACRO_BLOCK;
+	vector<Tagent *> &members = regions[regionOf(left, top)];
+
+	// Backwards, as removing an agent moves the region's last one into its place
+	for (int i = static_cast<int>(members.size()) - 1; i >= 0; i--) {
+		Ped::Tagent *agent = members[i];
+		if (macroBlockOf(agent->getX(), agent->getY()) != block) {
+			continue;
+		}
+		removeFromRegion(agent);
+
+		// Nobody would wake a carried agent that was asleep
+		agent->wake();
+		agent->setMacroBlock(block);
+		macroAgents[block].push_back(agent);
+	}
+}
+
+bool Ped::Model::moveMacroAgent(Tagent *agent, int block)
+{
+	std::pair<int, int> alternatives[3];
+	prioritizedAlternatives(agent, alternatives);
+	for (int i = 0; i < 3; i++) {
+		const int altX = alternatives[i].first;
+		const int altY = alternatives[i].second;
+		const int target = macroBlockOf(altX, altY);
+		if (target < 0 || obstacleGrid.isBlocked(altX, altY)) {
+			continue;
+		}
+		if (target == block) {
+			if (coordinates[altX][altY] == -1) {
+				placeOnCell(agent, altX, altY);
+				return false;
+			}
+		}
+		else if (macroCredit[block] >= 1 && flowMacroAgent(agent, target, altX, altY)) {
+			macroCredit[block] -= 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool Ped::Model::flowMacroAgent(Tagent *agent, int target, int x, int y)
+{
+	if (macroReceived[target] + 1 > macroReceive[target]) {
+		return false;
+	}
+
+	// Any free cell of a density block will do, but an agent leaving
+	// onto the floor is placed next to the cell it wanted
+	const bool dense = macroDense[target] != 0;
+	int cellX, cellY;
+	if (!findMacroCell(target, x, y, dense ? MACRO_BLOCK : 1, cellX, cellY)) {
+		return false;
+	}
+	placeOnCell(agent, cellX, cellY);
+	macroReceived[target]++;
+
+	if (dense) {
+		agent->setMacroBlock(target);
+		macroArrivals.push_back(std::make_pair(agent, target));
+	}
+	else {
+		agent->setMacroBlock(-1);
+		addToRegion(agent, regionOf(cellX, cellY));
+	}
+	return true;
+}
+
+bool Ped::Model::findMacroCell(int block, int x, int y, int maxDistance, int &cellX, int &cellY) const
+{
+	const int left = (block % macroBlocksPerSide) * MACRO_BLOCK;
+	const int top = (block / macroBlocksPerSide) * MACRO_BLOCK;
+	const int right = std::min(left + MACRO_BLOCK, WORLD_SIZE);
+	const int bottom = std::min(top + MACRO_BLOCK, WORLD_SIZE);
+	int best = maxDistance + 1;
+	for (int cy = top; cy < bottom; cy++) {
+		for (int cx = left; cx < right; cx++) {
+			const int distance = std::max(std::abs(cx - x), std::abs(cy - y));
+			if (distance >= best || obstacleGrid.isBlocked(cx, cy) || coordinates[cx][cy] != -1) {
+				continue;
+			}
+			best = distance;
+			cellX = cx;
+			cellY = cy;
+		}
+	}
+	return best <= maxDistance;
+}
+
+void Ped::Model::placeOnCell(Tagent *agent, int x, int y)
+{
+	const int oldX = agent->getX();
+	const int oldY = agent->getY();
+	coordinates[x][y] = agent->getId();
+	if (coordinates[oldX][oldY] == agent->getId()) {
+		coordinates[oldX][oldY] = -1;
+		releaseCell(oldX, oldY);
+	}
+	agent->setX(x);
+	agent->setY(y);
+}
+
+void Ped::Model::removeFromMacro(Tagent *agent)
+{
+	std::vector<Tagent*> &carried = macroAgents[agent->getMacroBlock()];
+	std::vector<Tagent*>::iterator position = std::find(carried.begin(), carried.end(), agent);
+	*position = carried.back();
+	carried.pop_back();
+	agent->setMacroBlock(-1);
+}
+
+void Ped::Model::rebuildMacroAgents()
+{
+	for (int block = 0; block < macroAgents.size(); block++) {
+		macroAgents[block].clear();
+	}
+	for (int i = 0; i < agents.size(); i++) {
+		if (!agents[i]->isActive()) {
+			agents[i]->setMacroBlock(-1);
+		}
+		else if (agents[i]->getMacroBlock() >= 0) {
+			macroAgents[agents[i]->getMacroBlock()].push_back(agents[i]);
+		}
+	}
+}
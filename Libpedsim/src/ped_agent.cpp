@@ -9,6 +9,9 @@
 #include "ped_waypoint.h"
 #include <math.h>
 #include<iostream>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 // Memory leak check with msvc++
 #define _CRTDBG_MAP_ALLOC
 #include <stdlib.h>
@@ -19,17 +22,47 @@
 
 Ped::Tagent::Tagent(int posX, int posY) {
 	Ped::Tagent::init(posX, posY);
+	lodBlock = -1;
+	lodList = LOD_UNLISTED;
+	macroBlock = -1;
 }
 
 Ped::Tagent::Tagent(double posX, double posY) {
 	Ped::Tagent::init((int)round(posX), (int)round(posY));
+	lodBlock = -1;
+	lodList = LOD_UNLISTED;
+	macroBlock = -1;
 }
 
 void Ped::Tagent::init(int posX, int posY) {
 	x = posX;
 	y = posY;
+	desiredPositionX = posX;
+	desiredPositionY = posY;
 	destination = NULL;
 	lastDestination = NULL;
+	active = true;
+	sleeping = 0;
+	nextWaypoint = 0;
+}
+
+void Ped::Tagent::activate(int posX, int posY) {
+	// clear() keeps the capacity, so the waypoints added next reuse it
+	waypoints.clear();
+	init(posX, posY);
+}
+
+void Ped::Tagent::deactivate() {
+	waypoints.clear();
+	destination = NULL;
+	desiredPositionX = x;
+	desiredPositionY = y;
+	active = false;
+	sleeping = 0;
+}
+
+bool Ped::Tagent::wake() {
+	return _InterlockedCompareExchange(&sleeping, 0, 1) == 1;
 }
 
 void Ped::Tagent::computeNextDesiredPosition() {
@@ -76,9 +109,8 @@ Ped::Twaypoint* Ped::Tagent::getNextDestination() {
 	if ((agentReachedDestination || destination == NULL) && !waypoints.empty()) {
 		// Case 1: agent has reached destination (or has no current destination);
 		// get next destination if available
-		waypoints.push_back(destination);
-		nextDestination = waypoints.front();
-		waypoints.pop_front();
+		nextDestination = nextWaypoint < waypoints.size() ? waypoints[nextWaypoint] : NULL;
+		nextWaypoint = (nextWaypoint + 1) % (waypoints.size() + 1);
 	}
 	else {
 		// Case 2: agent has not yet reached destination, continue to move towards
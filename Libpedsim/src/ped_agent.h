@@ -17,13 +17,28 @@
 #define _ped_agent_h_ 1
 
 #include <vector>
-#include <deque>
+#include <cstddef>
 
 using namespace std;
 
 namespace Ped {
 	class Twaypoint;
 
+	// One component of the rounded unit step towards a target that is
+	// diff cells away on this axis and otherDiff cells on the other axis,
+	// i.e. round(diff / sqrt(diff^2 + otherDiff^2)), without sqrt or division.
+	//
+	// The component is nonzero exactly when |diff| / len > 1/2, which is
+	// 4 * diff^2 > diff^2 + otherDiff^2, or 3 * diff^2 > otherDiff^2.
+	// Ties (|diff| / len == 1/2 exactly) would need 3 * diff^2 == otherDiff^2,
+	// which has no integer solution except 0, 0 since sqrt(3) is irrational.
+	// So for integer positions and targets this matches round() in
+	// Tagent::computeNextDesiredPosition. Valid while |diff| and |otherDiff|
+	// are below 16384, so 3 * diff^2 fits in an int; the world is 1024 cells.
+	inline int unitStep(int diff, int otherDiff) {
+		return (3 * diff * diff > otherDiff * otherDiff) * ((diff > 0) - (diff < 0));
+	}
+
 	class Tagent {
 	public:
 		Tagent(int posX, int posY);
@@ -37,6 +52,9 @@ namespace Ped {
 		void setX(int newX) { x = newX; }
 		void setY(int newY) { y = newY; }
 
+		// Sets the desired position, for backends that compute it outside the agent
+		void setDesiredPosition(int newX, int newY) { desiredPositionX = newX; desiredPositionY = newY; }
+
 		// Update the position according to get closer
 		// to the current destination
 		void computeNextDesiredPosition();
@@ -52,12 +70,54 @@ namespace Ped {
 		int getRegionId() const { return regionId; };
 		void setRegionId(int newRegionId) { regionId = newRegionId; };
 
+		// Index of the agent in its region's list
+		int getRegionIndex() const { return regionIndex; };
+		void setRegionIndex(int newRegionIndex) { regionIndex = newRegionIndex; };
+
+		// Block of the hybrid model that carries the agent instead of its
+		// region, or -1, see Model::setHybrid
+		int getMacroBlock() const { return macroBlock; };
+		void setMacroBlock(int newMacroBlock) { macroBlock = newMacroBlock; };
+
+		// Level of detail block the agent is counted in, or -1, and the
+		// list it is in: LOD_UNLISTED, LOD_DENSE or the tick of the
+		// level of detail cycle on which it is advanced, see
+		// Model::setLevelOfDetail
+		int getLodBlock() const { return lodBlock; };
+		void setLodBlock(int newLodBlock) { lodBlock = newLodBlock; };
+		int getLodList() const { return lodList; };
+		void setLodList(int newLodList) { lodList = newLodList; };
+		enum { LOD_UNLISTED = -2, LOD_DENSE = -1 };
+
 		long getId() const { return id; };
 		void setId(long newId) { id = newId; };
 
 		// Adds a new waypoint to reach for this agent
 		void addWaypoint(Twaypoint* wp);
 
+		// Reserves room for n waypoints, so adding them later never allocates
+		void reserveWaypoints(size_t n) { waypoints.reserve(n); };
+
+		// False if this agent is a free slot waiting to be spawned.
+		// Inactive agents are skipped by every part of the model.
+		bool isActive() const { return active; };
+
+		// Puts the agent into the simulation at (posX, posY), without
+		// any waypoints. Never allocates.
+		void activate(int posX, int posY);
+
+		// Takes the agent out of the simulation, e.g. when it reaches a sink
+		void deactivate();
+
+		// Set while the agent is stuck and waits for one of the cells it
+		// wants to move to to be freed, see Model::moveRegions
+		bool isAsleep() const { return sleeping != 0; };
+		void sleep() { sleeping = 1; };
+
+		// Wakes the agent up. Returns true if it was asleep; when several
+		// threads wake it at once, only one of them gets true.
+		bool wake();
+
 		// The current destination (may require several steps to reach)
 		Twaypoint* destination;
 
@@ -74,14 +134,31 @@ namespace Ped {
 
 		// The agent's region
 		int regionId;
+		int regionIndex;
+		int macroBlock;
+
+		// See getLodBlock. Kept over deactivate() and activate(), which
+		// may happen while the agent is still listed.
+		int lodBlock;
+		int lodList;
 
 		long id;
 
 		// The last destination
 		Twaypoint* lastDestination;
 
-		// The queue of all destinations that this agent still has to visit
-		deque<Twaypoint*> waypoints;
+		// False while this agent's slot is free
+		bool active;
+
+		// See isAsleep; a long for the interlocked exchange in wake()
+		volatile long sleeping;
+
+		// All destinations of this agent, visited in a cycle. After the
+		// last one the agent has no destination for one tick, before it
+		// starts over. nextWaypoint == waypoints.size() stands for that
+		// empty step.
+		vector<Twaypoint*> waypoints;
+		size_t nextWaypoint;
 
 		// Internal init function 
 		void init(int posX, int posY);
@@ -92,12 +169,14 @@ namespace Ped {
 	class TagentSIMD {
 	public:
 		TagentSIMD(int nAgents) {
-			x = (int *)_mm_malloc(nAgents * sizeof(int), 16);
-			y = (int *)_mm_malloc(nAgents * sizeof(int), 16);
-			desiredX = (int *)_mm_malloc(nAgents * sizeof(int), 16);
-			desiredY = (int *)_mm_malloc(nAgents * sizeof(int), 16);
-			destinationX = (float *)_mm_malloc(nAgents * sizeof(float), 16);
-			destinationY = (float *)_mm_malloc(nAgents * sizeof(float), 16);
+			// Rounded up to whole vectors, since the SIMD loops load 4 at a time
+			const int lanes = (nAgents + 3) & ~3;
+			x = (int *)_mm_malloc(lanes * sizeof(int), 16);
+			y = (int *)_mm_malloc(lanes * sizeof(int), 16);
+			desiredX = (int *)_mm_malloc(lanes * sizeof(int), 16);
+			desiredY = (int *)_mm_malloc(lanes * sizeof(int), 16);
+			destinationX = (float *)_mm_malloc(lanes * sizeof(float), 16);
+			destinationY = (float *)_mm_malloc(lanes * sizeof(float), 16);
 
 		};
 		//private:
@@ -0,0 +1,45 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// TblurKernel is the Gaussian blur of the heatmap, for a radius of
+// 1, 2 or 3 pixels (a 3x3, 5x5 or 7x7 kernel). Its weights are a row
+// of Pascal's triangle, the binomial approximation of a Gaussian,
+// computed at compile time. The kernel is separable: a horizontal
+// and a vertical pass with the same weights. The weights of one pass
+// sum to 2^(2 * radius), so a blurred value is normalized by a shift
+// instead of a division.
+//
+#ifndef _ped_blur_h_
+#define _ped_blur_h_ 1
+
+namespace Ped {
+	// n over k
+	constexpr int binomial(int n, int k) {
+		return (k == 0 || k == n) ? 1 : binomial(n - 1, k - 1) + binomial(n - 1, k);
+	}
+
+	template<int Radius>
+	struct TblurKernel {
+		enum {
+			radius = Radius,
+			taps = 2 * Radius + 1,
+
+			// Both passes together sum to 2^shift
+			shift = 4 * Radius
+		};
+
+		// Weight of tap i, 0 <= i < taps
+		static constexpr int weight(int i) { return binomial(2 * Radius, i); }
+
+		// Sum of the weights of taps i to taps - 1
+		static constexpr int weightSum(int i = 0) { return i == taps ? 0 : weight(i) + weightSum(i + 1); }
+
+		static_assert(Radius >= 1 && Radius <= 3, "blur radius must be 1, 2 or 3");
+	};
+
+	static_assert(TblurKernel<1>::weightSum() == 1 << (TblurKernel<1>::shift / 2), "3x3 weights don't sum to a power of two");
+	static_assert(TblurKernel<2>::weightSum() == 1 << (TblurKernel<2>::shift / 2), "5x5 weights don't sum to a power of two");
+	static_assert(TblurKernel<3>::weightSum() == 1 << (TblurKernel<3>::shift / 2), "7x7 weights don't sum to a power of two");
+}
+
+#endif
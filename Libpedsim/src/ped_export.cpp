@@ -0,0 +1,153 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+
+// Before ped_model.h, whose SIZE would clash with the one of windows.h
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "ped_export.h"
+#include "ped_model.h"
+#include <iostream>
+#include <algorithm>
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+// Crowds at least this large are copied by several threads
+#define EXPORT_PARALLEL_AGENTS 16384
+
+// Arrays start on cache lines of their own
+static size_t alignUp(size_t offset)
+{
+	return (offset + 63) & ~(size_t)63;
+}
+
+Ped::Texport::Texport(const std::string &name, const Model &model) : name(name), size(0), header(NULL),
+	x(NULL), y(NULL), active(NULL), heatmap(NULL), mapping(NULL)
+{
+	const size_t agents = model.getAgents().size();
+	const size_t heatmapSize = SIZE;
+	const size_t xOffset = alignUp(sizeof(TexportHeader));
+	const size_t yOffset = alignUp(xOffset + agents * sizeof(std::int32_t));
+	const size_t activeOffset = alignUp(yOffset + agents * sizeof(std::int32_t));
+	const size_t heatmapOffset = alignUp(activeOffset + agents);
+	size = heatmapOffset + heatmapSize * heatmapSize;
+
+	void *base = NULL;
+#ifdef _WIN32
+	mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size, name.c_str());
+	if (mapping != NULL) {
+		base = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+	}
+#else
+	const std::string path = "/" + name;
+	const int fd = shm_open(path.c_str(), O_CREAT | O_RDWR, 0644);
+	if (fd >= 0) {
+		if (ftruncate(fd, size) == 0) {
+			base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (base == MAP_FAILED) {
+				base = NULL;
+			}
+		}
+		close(fd);
+	}
+#endif
+	if (base == NULL) {
+		std::cerr << "Cannot create the shared memory segment " << name << std::endl;
+		return;
+	}
+
+	header = static_cast<TexportHeader *>(base);
+	header->magic = TexportHeader::MAGIC;
+	header->version = TexportHeader::VERSION;
+	header->sequence.store(0, std::memory_order_relaxed);
+	header->agentCapacity = (std::uint32_t)agents;
+	header->heatmapSize = (std::uint32_t)heatmapSize;
+	header->padding = 0;
+	header->tick = 0;
+	header->xOffset = xOffset;
+	header->yOffset = yOffset;
+	header->activeOffset = activeOffset;
+	header->heatmapOffset = heatmapOffset;
+
+	char *bytes = static_cast<char *>(base);
+	x = reinterpret_cast<std::int32_t *>(bytes + xOffset);
+	y = reinterpret_cast<std::int32_t *>(bytes + yOffset);
+	active = reinterpret_cast<std::uint8_t *>(bytes + activeOffset);
+	heatmap = reinterpret_cast<std::uint8_t *>(bytes + heatmapOffset);
+}
+
+Ped::Texport::~Texport()
+{
+	if (header == NULL) {
+		return;
+	}
+#ifdef _WIN32
+	UnmapViewOfFile(header);
+	CloseHandle(mapping);
+#else
+	munmap(header, size);
+	shm_unlink(("/" + name).c_str());
+#endif
+}
+
+void Ped::Texport::publish(const Model &model)
+{
+	if (header == NULL) {
+		return;
+	}
+
+	// Odd while writing; the fence keeps the writes below after it
+	const std::uint32_t sequence = header->sequence.load(std::memory_order_relaxed);
+	header->sequence.store(sequence + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	// Reading the agents is what costs; large crowds are split over
+	// threads so the copy stays small next to the tick
+	const std::vector<Tagent*> &agents = model.getAgents();
+	const int count = (int)std::min<size_t>(agents.size(), header->agentCapacity);
+#pragma omp parallel for if(count >= EXPORT_PARALLEL_AGENTS)
+	for (int i = 0; i < count; i++) {
+		x[i] = agents[i]->getX();
+		y[i] = agents[i]->getY();
+		active[i] = agents[i]->isActive();
+	}
+
+	// Only the cells under the heatmap's dirty rectangles changed,
+	// except on the first publish, which may come after many ticks
+	const int scale = model.getHeatmapSize() / SIZE;
+	int const * const *blurred = model.getHeatmap();
+	const HeatmapRect all = { 0, 0, model.getHeatmapSize(), model.getHeatmapSize() };
+	const std::vector<HeatmapRect> &dirty = model.getHeatmapDirtyRects();
+	const HeatmapRect *rects = header->tick == 0 ? &all : dirty.data();
+	const size_t rectCount = header->tick == 0 ? 1 : dirty.size();
+	for (size_t r = 0; r < rectCount; r++) {
+		const int left = rects[r].x / scale;
+		const int top = rects[r].y / scale;
+		const int right = std::min((rects[r].x + rects[r].width - 1) / scale, SIZE - 1);
+		const int bottom = std::min((rects[r].y + rects[r].height - 1) / scale, SIZE - 1);
+		for (int cy = top; cy <= bottom; cy++) {
+			const int *row = blurred[cy * scale + scale / 2];
+			std::uint8_t *target = heatmap + (size_t)cy * SIZE;
+			for (int cx = left; cx <= right; cx++) {
+				target[cx] = (std::uint8_t)((unsigned int)row[cx * scale + scale / 2] >> 24);
+			}
+		}
+	}
+
+	header->tick++;
+	header->sequence.store(sequence + 2, std::memory_order_release);
+}
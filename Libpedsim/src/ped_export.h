@@ -0,0 +1,90 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Texport publishes the model's agent positions and heatmap in a
+// named shared-memory segment after every tick, so that other
+// processes can read them without going through the model. The
+// segment starts with a TexportHeader; the arrays follow at the
+// offsets it gives:
+//
+//   int32 x[agentCapacity], int32 y[agentCapacity]
+//   uint8 active[agentCapacity]
+//   uint8 heatmap[heatmapSize * heatmapSize]
+//
+// x, y and active are in the order of Model::getAgents(). The
+// heatmap has one byte per cell: the blurred heatmap's intensity at
+// the center of the cell, row by row.
+//
+// The header's sequence number is a seqlock: it is odd while a tick
+// is being written. A reader reads the sequence (acquire), skips the
+// snapshot if it is odd, reads what it needs straight from the
+// mapping, and keeps what it read only if the sequence (read after
+// an acquire fence) is unchanged. Nothing is copied for the reader,
+// and the writer never waits for one.
+//
+// Only what changed is written: the positions of the agents, and
+// the heatmap cells under the model's dirty rectangles.
+//
+#ifndef _ped_export_h_
+#define _ped_export_h_ 1
+
+#include <atomic>
+#include <string>
+#include <cstdint>
+
+namespace Ped {
+	class Model;
+
+	struct TexportHeader {
+		enum { MAGIC = 0x58444550, VERSION = 1 }; // "PEDX"
+
+		std::uint32_t magic;
+		std::uint32_t version;
+		std::atomic<std::uint32_t> sequence;
+		std::uint32_t agentCapacity;
+		std::uint32_t heatmapSize;
+		std::uint32_t padding;
+
+		// Ticks published so far
+		std::uint64_t tick;
+
+		// Byte offsets of the arrays from the start of the segment
+		std::uint64_t xOffset;
+		std::uint64_t yOffset;
+		std::uint64_t activeOffset;
+		std::uint64_t heatmapOffset;
+	};
+
+	class Texport {
+	public:
+		// Creates the segment: "/name" with shm_open, or a named file
+		// mapping on Windows. isOpen() tells whether that worked.
+		Texport(const std::string &name, const Model &model);
+
+		// Unmaps and removes the segment. Readers that still have it
+		// mapped keep their view.
+		~Texport();
+
+		bool isOpen() const { return header != NULL; };
+
+		// Writes the model's state of the tick that just ended
+		void publish(const Model &model);
+
+	private:
+		Texport(const Texport&) = delete;
+		Texport &operator=(const Texport&) = delete;
+
+		std::string name;
+		size_t size;
+		TexportHeader *header;
+		std::int32_t *x;
+		std::int32_t *y;
+		std::uint8_t *active;
+		std::uint8_t *heatmap;
+
+		// Handle of the mapping on Windows
+		void *mapping;
+	};
+}
+
+#endif
@@ -0,0 +1,98 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Implements the per-waypoint flow fields.
+//
+#include "ped_flowfield.h"
+#include "ped_waypoint.h"
+#include "ped_agent.h"
+#include "ped_obstacle.h"
+
+#include <cmath>
+#include <algorithm>
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+Ped::Tflowfield::Tflowfield(int width, int height) : width(width), height(height),
+	distance(width * height, -1), direction(width * height, UNREACHABLE)
+{
+}
+
+void Ped::Tflowfield::build(const Twaypoint *waypoint, const TobstacleGrid &obstacles)
+{
+	const int targetX = (int)round(waypoint->getx());
+	const int targetY = (int)round(waypoint->gety());
+
+	std::fill(distance.begin(), distance.end(), -1);
+	std::fill(direction.begin(), direction.end(), (signed char)UNREACHABLE);
+	if (targetX < 0 || targetY < 0 || targetX >= width || targetY >= height || obstacles.isBlocked(targetX, targetY)) {
+		// Waypoint outside the world or inside a wall: every agent walks straight
+		return;
+	}
+
+	// Breadth first search from the waypoint; every step, straight or
+	// diagonal, costs one tick.
+	std::vector<int> queue(width * height);
+	int head = 0;
+	int tail = 0;
+	distance[targetY * width + targetX] = 0;
+	queue[tail++] = targetY * width + targetX;
+	while (head < tail) {
+		const int cell = queue[head++];
+		const int x = cell % width;
+		const int y = cell / width;
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				const int nx = x + dx;
+				const int ny = y + dy;
+				if (nx < 0 || ny < 0 || nx >= width || ny >= height || obstacles.isBlocked(nx, ny)) {
+					continue;
+				}
+				if (distance[ny * width + nx] == -1) {
+					distance[ny * width + nx] = distance[cell] + 1;
+					queue[tail++] = ny * width + nx;
+				}
+			}
+		}
+	}
+
+	// Pick the best step for every reachable cell. Among the neighbors
+	// that are one step closer, prefer the step an agent walking
+	// straight would take (Ped::unitStep). On open floor that step is
+	// always among the best ones, so the field gives the same paths
+	// as the direct computation.
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			const int d = distance[y * width + x];
+			if (d <= 0) {
+				if (d == 0) {
+					direction[y * width + x] = 4;
+				}
+				continue;
+			}
+
+			const int straightX = Ped::unitStep(targetX - x, targetY - y);
+			const int straightY = Ped::unitStep(targetY - y, targetX - x);
+			int best = -1;
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					const int nx = x + dx;
+					const int ny = y + dy;
+					if (nx < 0 || ny < 0 || nx >= width || ny >= height || distance[ny * width + nx] != d - 1) {
+						continue;
+					}
+					if (best == -1 || (dx == straightX && dy == straightY)) {
+						best = (dy + 1) * 3 + (dx + 1);
+					}
+				}
+			}
+			direction[y * width + x] = (signed char)best;
+		}
+	}
+}
@@ -0,0 +1,59 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Tflowfield stores, for every cell of the world, the distance
+// to one waypoint and the best step to take towards it. All agents
+// heading to the same waypoint share one field, so finding the
+// next step of an agent is a single array lookup.
+//
+#ifndef _ped_flowfield_h_
+#define _ped_flowfield_h_ 1
+
+#include <vector>
+
+namespace Ped {
+	class Twaypoint;
+	class TobstacleGrid;
+
+	class Tflowfield {
+	public:
+		Tflowfield(int width, int height);
+
+		// Computes the field towards the waypoint with a breadth first
+		// search over the 8-connected grid of cells. Blocked cells are
+		// never entered, so the steps lead around walls.
+		void build(const Twaypoint *waypoint, const TobstacleGrid &obstacles);
+
+		// Returns the step to take from (x, y) towards the waypoint.
+		// Returns false if (x, y) is outside the field or cannot reach
+		// the waypoint; callers then fall back to walking straight.
+		bool getStep(int x, int y, int &stepX, int &stepY) const {
+			if (x < 0 || y < 0 || x >= width || y >= height) {
+				return false;
+			}
+			const signed char code = direction[y * width + x];
+			if (code == UNREACHABLE) {
+				return false;
+			}
+			stepX = code % 3 - 1;
+			stepY = code / 3 - 1;
+			return true;
+		}
+
+		// Number of steps from (x, y) to the waypoint, -1 if unreachable
+		int getDistance(int x, int y) const { return distance[y * width + x]; }
+
+	private:
+		// Directions are stored as (stepY + 1) * 3 + (stepX + 1),
+		// so the waypoint's own cell holds 4 (no step).
+		enum { UNREACHABLE = -1 };
+
+		int width;
+		int height;
+
+		std::vector<int> distance;
+		std::vector<signed char> direction;
+	};
+}
+
+#endif
@@ -0,0 +1,89 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+#include "ped_metrics.h"
+#include <algorithm>
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+// Every thread that ever adds to a counter gets the next index
+static std::atomic<int> threadCount(0);
+
+static int threadIndex()
+{
+	static thread_local int index = threadCount.fetch_add(1, std::memory_order_relaxed);
+	return index;
+}
+
+Ped::Tmetrics::Tmetrics() : agents(0)
+{
+	for (int i = 0; i < MAX_THREADS; i++) {
+		for (int c = 0; c < COUNTER_COUNT; c++) {
+			slots[i].counts[c].store(0, std::memory_order_relaxed);
+		}
+	}
+	for (int l = 0; l < LATENCY_COUNT; l++) {
+		windows[l].recorded.store(0, std::memory_order_relaxed);
+	}
+}
+
+void Ped::Tmetrics::add(COUNTER counter, long long amount)
+{
+	Slot &slot = slots[std::min<int>(threadIndex(), MAX_THREADS - 1)];
+	slot.counts[counter].fetch_add(amount, std::memory_order_relaxed);
+}
+
+void Ped::Tmetrics::record(LATENCY latency, double seconds)
+{
+	Window &window = windows[latency];
+	const unsigned int next = window.recorded.load(std::memory_order_relaxed);
+	window.samples[next % LATENCY_WINDOW].store((float)seconds, std::memory_order_relaxed);
+	window.recorded.store(next + 1, std::memory_order_release);
+}
+
+long long Ped::Tmetrics::total(COUNTER counter) const
+{
+	long long sum = 0;
+	for (int i = 0; i < MAX_THREADS; i++) {
+		sum += slots[i].counts[counter].load(std::memory_order_relaxed);
+	}
+	return sum;
+}
+
+double Ped::Tmetrics::percentile(LATENCY latency, double p) const
+{
+	const Window &window = windows[latency];
+	const unsigned int count = std::min<unsigned int>(window.recorded.load(std::memory_order_acquire), LATENCY_WINDOW);
+	if (count == 0) {
+		return -1;
+	}
+
+	std::vector<float> samples(count);
+	for (unsigned int i = 0; i < count; i++) {
+		samples[i] = window.samples[i].load(std::memory_order_relaxed);
+	}
+
+	// Nearest rank
+	size_t rank = (size_t)(p / 100.0 * count);
+	rank = std::min<size_t>(rank, count - 1);
+	std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+	return samples[rank];
+}
+
+const char *Ped::Tmetrics::name(COUNTER counter)
+{
+	static const char *names[] = { "ticks", "collision_retries", "collision_failures" };
+	return names[counter];
+}
+
+const char *Ped::Tmetrics::name(LATENCY latency)
+{
+	static const char *names[] = { "tick", "movement", "heatmap" };
+	return names[latency];
+}
@@ -0,0 +1,85 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Tmetrics collects live measurements of a running model for another
+// thread, such as a metrics endpoint, to read at any time. Neither
+// side ever takes a lock:
+//
+// - Counters are kept per thread. Each thread adds to its own slot,
+//   on its own cache line, and a reader sums the slots.
+// - Latencies are written by the thread that ticks the model into a
+//   ring of the last LATENCY_WINDOW samples, which a reader copies to
+//   compute percentiles. A reader racing the writer may see a sample
+//   of the previous lap, which is harmless for percentiles.
+//
+#ifndef _ped_metrics_h_
+#define _ped_metrics_h_ 1
+
+#include <atomic>
+#include <vector>
+
+namespace Ped {
+	class Tmetrics {
+	public:
+		enum COUNTER {
+			TICKS,
+			// Agents that could not step onto their desired cell and
+			// tried another one, and agents that could not step at all
+			COLLISION_RETRIES,
+			COLLISION_FAILURES,
+			COUNTER_COUNT
+		};
+
+		enum LATENCY { TICK_LATENCY, MOVEMENT_LATENCY, HEATMAP_LATENCY, LATENCY_COUNT };
+
+		Tmetrics();
+
+		// Adds to the calling thread's counter
+		void add(COUNTER counter, long long amount = 1);
+
+		// Records a duration. Only one thread may record.
+		void record(LATENCY latency, double seconds);
+
+		void setAgentCount(int count) { agents.store(count, std::memory_order_relaxed); };
+
+		// Reader side; safe to call from any thread at any time
+
+		// Sum of the counter over all threads
+		long long total(COUNTER counter) const;
+
+		// The p-th percentile (0 to 100) of the last LATENCY_WINDOW
+		// samples in seconds, or -1 if nothing was recorded
+		double percentile(LATENCY latency, double p) const;
+
+		int getAgentCount() const { return agents.load(std::memory_order_relaxed); };
+
+		static const char *name(COUNTER counter);
+		static const char *name(LATENCY latency);
+
+	private:
+		Tmetrics(const Tmetrics&) = delete;
+		Tmetrics &operator=(const Tmetrics&) = delete;
+
+		enum { MAX_THREADS = 256, LATENCY_WINDOW = 1024 };
+
+		// One thread's counters, padded to a cache line of its own
+		struct Slot {
+			std::atomic<long long> counts[COUNTER_COUNT];
+			char padding[64 - COUNTER_COUNT * sizeof(long long)];
+		};
+
+		// Threads past MAX_THREADS share the last slot, which is still
+		// correct as every add is atomic
+		Slot slots[MAX_THREADS];
+
+		struct Window {
+			std::atomic<float> samples[LATENCY_WINDOW];
+			std::atomic<unsigned int> recorded;
+		};
+		Window windows[LATENCY_COUNT];
+
+		std::atomic<int> agents;
+	};
+}
+
+#endif
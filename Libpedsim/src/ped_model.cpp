@@ -12,6 +12,7 @@
 #include <thread>
 #include <stack>
 #include <algorithm>
+#include <functional>
 #include "cuda_testkernel.h"
 #include <omp.h>
 #include <smmintrin.h>
@@ -25,6 +26,8 @@
 #define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
 #endif
 
+// Manhattan distance, defined further down
+double getDistance(int x1, int y1, int x2, int y2);
 
 /*// Print the content of a __m128-variable.
 void print128i_num(__m128i var)
@@ -43,6 +46,17 @@ val[0], val[1], val[2], val[3]);
 
 
 void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<Twaypoint*> destinationsInScenario, IMPLEMENTATION implementation)
+{
+	setup(agentsInScenario, destinationsInScenario, std::vector<Ped::Tobstacle*>(), implementation);
+}
+
+void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<Twaypoint*> destinationsInScenario, std::vector<Ped::Tobstacle*> obstaclesInScenario, IMPLEMENTATION implementation)
+{
+	setup(agentsInScenario, destinationsInScenario, obstaclesInScenario, std::vector<Ped::Tsource*>(), std::vector<Ped::Tsink*>(), implementation);
+}
+
+void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<Twaypoint*> destinationsInScenario, std::vector<Ped::Tobstacle*> obstaclesInScenario,
+	std::vector<Ped::Tsource*> sourcesInScenario, std::vector<Ped::Tsink*> sinksInScenario, IMPLEMENTATION implementation)
 {
 	// Convenience test: does CUDA work on this machine?
 	cuda_test();
@@ -50,6 +64,41 @@ void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<T
 	// Set 
 	agents = std::vector<Ped::Tagent*>(agentsInScenario.begin(), agentsInScenario.end());
 
+	// Free slots for the agents the sources will spawn, with room for
+	// their waypoints. Everything spawning needs is allocated here.
+	sources = sourcesInScenario;
+	sinks = sinksInScenario;
+	int spawnCapacity = 0;
+	size_t maxWaypoints = 0;
+	for (int i = 0; i < sources.size(); i++) {
+		spawnCapacity += std::max(sources[i]->getMax(), 0);
+		maxWaypoints = std::max(maxWaypoints, sources[i]->getWaypoints().size());
+	}
+	freeSlots.clear();
+	freeSlots.reserve(agents.size() + spawnCapacity);
+	agentPool.reserve(spawnCapacity);
+	for (int i = 0; i < spawnCapacity; i++) {
+		Ped::Tagent *agent = createAgent(0, 0);
+		agent->reserveWaypoints(maxWaypoints);
+		agent->deactivate();
+		agents.push_back(agent);
+	}
+
+	// Walk the agents in the order they lie in memory, so that sorting
+	// their contents in cleanup() also sorts the memory accesses
+	std::sort(agents.begin(), agents.end(), std::less<Ped::Tagent*>());
+
+	// Hand out the lowest slots first
+	for (int i = static_cast<int>(agents.size()) - 1; i >= 0; i--) {
+		if (!agents[i]->isActive()) {
+			freeSlots.push_back(i);
+		}
+	}
+	slotSource = std::vector<int>(agents.size(), -1);
+	sourceAlive = std::vector<int>(sources.size(), 0);
+	spawnCredit = std::vector<double>(sources.size(), 0.0);
+	spawnRandom = 2463534242u;
+
 	agentsSIMD = Ped::TagentSIMD(static_cast<int>(agents.size()));
 	for (int i = 0; i < agents.size(); i++) {
 		agentsSIMD.x[i] = agents[i]->getX();
@@ -74,40 +123,34 @@ void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<T
 
 
 	// Assign region for all the agents and get the list of agents in each region
-	// TODO: Dynamically get region boundaries
-	for (int i = 0; i < agents.size(); i++) {
-		if (agents[i]->getX() < 100) {
-			if (agents[i]->getY() < 60) {
-				region1.insert(agents[i]);
-				agents[i]->setRegionId(1);
-			}
-			else {
-				region3.insert(agents[i]);
-				agents[i]->setRegionId(3);
-			}
-		}
-		else {
-			if (agents[i]->getY() < 60) {
-				region2.insert(agents[i]);
-				agents[i]->setRegionId(2);
-			}
-			else {
-				region4.insert(agents[i]);
-				agents[i]->setRegionId(4);
-			}
-		}
-	}
+	setupRegions();
+	assignRegions();
 
 	for (int i = 0; i < agents.size(); i++) {
 		agents[i]->setId(i);
 	}
 
+	// Locality is measured against the order setup() starts with
+	ticksSinceReorder = 0;
+	reorderBaseline = agentLocality();
+	reorderOrder.reserve(agents.size());
+	reorderVisited.reserve(agents.size());
 
-	// TODO: change 300 to something else? Remember to change it in the tick-function as well.
-	vector<long> v(300, -1);
-	coordinates = vector<vector<long>>(300, v);
+
+	// Rasterize the walls once; from here on an obstacle check is one bit test
+	obstacles = obstaclesInScenario;
+	obstacleGrid = Ped::TobstacleGrid(WORLD_SIZE, WORLD_SIZE);
+	for (int i = 0; i < obstacles.size(); i++) {
+		obstacleGrid.add(*obstacles[i]);
+	}
+
+	vector<long> v(WORLD_SIZE, -1);
+	coordinates = vector<vector<long>>(WORLD_SIZE, v);
 
 	for (int i = 0; i < agents.size(); i++) {
+		if (!agents[i]->isActive()) {
+			continue;
+		}
 		coordinates[agents[i]->getX()][agents[i]->getY()] = agents[i]->getId();
 	}
 
@@ -116,16 +159,50 @@ void Ped::Model::setup(std::vector<Ped::Tagent*> agentsInScenario, std::vector<T
 	// Set up destinations
 	destinations = std::vector<Ped::Twaypoint*>(destinationsInScenario.begin(), destinationsInScenario.end());
 
+	// Flow fields are built lazily, see buildRequestedFlowFields
+	firstWaypointId = 0;
+	int lastWaypointId = -1;
+	for (int i = 0; i < destinations.size(); i++) {
+		if (i == 0 || destinations[i]->getid() < firstWaypointId) {
+			firstWaypointId = destinations[i]->getid();
+		}
+		lastWaypointId = std::max(lastWaypointId, destinations[i]->getid());
+	}
+	flowFields = std::vector<Ped::Tflowfield*>(lastWaypointId - firstWaypointId + 1, NULL);
+	flowFieldRequested = std::vector<std::atomic<unsigned char> >(flowFields.size());
+	for (int i = 0; i < flowFieldRequested.size(); i++) {
+		flowFieldRequested[i].store(0, std::memory_order_relaxed);
+	}
+
 	// Sets the chosen implemenation. Standard in the given code is SEQ
 	this->implementation = implementation;
+	tickFunction = pipelineFor(implementation, stageTiming);
+	setStageCounting(stageCounting);
+	setLevelOfDetail(levelOfDetail);
+	setHybrid(hybrid);
+
+	// Only the SEQCOLLISION implementations search for neighbors in the tree
+	delete tree;
+	tree = NULL;
+	if (implementation == SEQCOLLISION || implementation == SEQCOLLISIONOMP) {
+		tree = new Ped::Ttree(WORLD_SIZE);
+		for (int i = 0; i < agents.size(); i++) {
+			if (agents[i]->isActive()) {
+				placeAgent(agents[i]);
+			}
+		}
+	}
 
 	// Set up heatmap (relevant for Assignment 4)
 	setupHeatmapSeq();
 }
 
-void thread_imp(int thread_id, std::vector<Ped::Tagent*> agents, int num_threads) {
+void thread_imp(int thread_id, const std::vector<Ped::Tagent*> &agents, int num_threads) {
 
 	for (int i = thread_id * agents.size() / num_threads; i < (thread_id + 1) * agents.size() / num_threads; ++i) {
+		if (!agents[i]->isActive()) {
+			continue;
+		}
 		agents[i]->computeNextDesiredPosition();
 		int newX = agents[i]->getDesiredX();
 		int newY = agents[i]->getDesiredY();
@@ -195,6 +272,10 @@ void Ped::Model::tick_SIMD() {
 
 	// Update the new coordinates for the agents and agents SIMD.
 	for (int i = 0; i < agents.size(); ++i) {
+		// Lanes of free slots hold junk until the slot is spawned again
+		if (!agents[i]->isActive()) {
+			continue;
+		}
 		agentsSIMD.x[i] = agentsSIMD.desiredX[i];
 		agentsSIMD.y[i] = agentsSIMD.desiredY[i];
 		agents[i]->setX(agentsSIMD.desiredX[i]);
@@ -203,7 +284,7 @@ void Ped::Model::tick_SIMD() {
 }
 
 void Ped::Model::tick_SIMDOMP() {
-	omp_set_num_threads(4);
+	omp_set_num_threads(ompThreads());
 	// Compute the destination for all agents and store it in the destination array for SIMD
 #pragma omp parallel for
 	for (int i = 0; i < agents.size(); i++) {
@@ -267,13 +348,277 @@ void Ped::Model::tick_SIMDOMP() {
 	// Update the new coordinates for the agents and agents SIMD.
 #pragma omp parallel for
 	for (int i = 0; i < agents.size(); ++i) {
+		// Lanes of free slots hold junk until the slot is spawned again
+		if (!agents[i]->isActive()) {
+			continue;
+		}
+		agentsSIMD.x[i] = agentsSIMD.desiredX[i];
+		agentsSIMD.y[i] = agentsSIMD.desiredY[i];
+		agents[i]->setX(agentsSIMD.desiredX[i]);
+		agents[i]->setY(agentsSIMD.desiredY[i]);
+	}
+}
+
+void Ped::Model::tick_INTSTEP() {
+	// Compute the destination for all agents. Agents without one aim at
+	// their own cell, which gives a zero step.
+	for (int i = 0; i < agents.size(); i++) {
+		agents[i]->destination = agents[i]->getNextDestination();
+		if (agents[i]->destination == NULL) {
+			agentsSIMD.destinationX[i] = (float)agentsSIMD.x[i];
+			agentsSIMD.destinationY[i] = (float)agentsSIMD.y[i];
+			continue;
+		}
+		agentsSIMD.destinationX[i] = agents[i]->destination->getx();
+		agentsSIMD.destinationY[i] = agents[i]->destination->gety();
+	}
+
+	// Four agents at a time: the same comparisons as Ped::unitStep, using
+	// compare masks and _mm_sign_epi32 instead of branches.
+	const __m128i one = _mm_set1_epi32(1);
+	const __m128i three = _mm_set1_epi32(3);
+	const int vectorEnd = static_cast<int>(agents.size()) & ~3;
+	for (int i = 0; i < vectorEnd; i += 4) {
+		__m128i posX = _mm_load_si128((__m128i *) &agentsSIMD.x[i]);
+		__m128i posY = _mm_load_si128((__m128i *) &agentsSIMD.y[i]);
+
+		// Destinations are rounded to the nearest cell, also when they
+		// are fractional or negative
+		__m128i diffX = _mm_sub_epi32(_mm_cvtps_epi32(_mm_load_ps(&agentsSIMD.destinationX[i])), posX);
+		__m128i diffY = _mm_sub_epi32(_mm_cvtps_epi32(_mm_load_ps(&agentsSIMD.destinationY[i])), posY);
+
+		__m128i diffXSquared = _mm_mullo_epi32(diffX, diffX);
+		__m128i diffYSquared = _mm_mullo_epi32(diffY, diffY);
+
+		__m128i moveX = _mm_cmpgt_epi32(_mm_mullo_epi32(three, diffXSquared), diffYSquared);
+		__m128i moveY = _mm_cmpgt_epi32(_mm_mullo_epi32(three, diffYSquared), diffXSquared);
+
+		__m128i stepX = _mm_and_si128(_mm_sign_epi32(one, diffX), moveX);
+		__m128i stepY = _mm_and_si128(_mm_sign_epi32(one, diffY), moveY);
+
+		_mm_store_si128((__m128i *) &agentsSIMD.desiredX[i], _mm_add_epi32(posX, stepX));
+		_mm_store_si128((__m128i *) &agentsSIMD.desiredY[i], _mm_add_epi32(posY, stepY));
+	}
+
+	// The remaining agents one at a time. lrintf rounds like
+	// _mm_cvtps_epi32, halves to even, so both agree on every agent.
+	for (int i = vectorEnd; i < agents.size(); i++) {
+		int diffX = (int)lrintf(agentsSIMD.destinationX[i]) - agentsSIMD.x[i];
+		int diffY = (int)lrintf(agentsSIMD.destinationY[i]) - agentsSIMD.y[i];
+		agentsSIMD.desiredX[i] = agentsSIMD.x[i] + Ped::unitStep(diffX, diffY);
+		agentsSIMD.desiredY[i] = agentsSIMD.y[i] + Ped::unitStep(diffY, diffX);
+	}
+
+	// Update the new coordinates for the agents and agents SIMD.
+	for (int i = 0; i < agents.size(); ++i) {
+		if (!agents[i]->isActive()) {
+			continue;
+		}
 		agentsSIMD.x[i] = agentsSIMD.desiredX[i];
 		agentsSIMD.y[i] = agentsSIMD.desiredY[i];
+		agents[i]->setDesiredPosition(agentsSIMD.desiredX[i], agentsSIMD.desiredY[i]);
 		agents[i]->setX(agentsSIMD.desiredX[i]);
 		agents[i]->setY(agentsSIMD.desiredY[i]);
 	}
 }
 
+void Ped::Model::buildRequestedFlowFields() {
+	std::vector<int> missing;
+	for (int i = 0; i < flowFields.size(); i++) {
+		if (flowFieldRequested[i].load(std::memory_order_relaxed) && flowFields[i] == NULL) {
+			missing.push_back(i);
+		}
+	}
+	if (missing.empty()) {
+		return;
+	}
+
+	std::vector<Ped::Twaypoint*> waypoints(flowFields.size(), NULL);
+	for (int i = 0; i < destinations.size(); i++) {
+		waypoints[destinations[i]->getid() - firstWaypointId] = destinations[i];
+	}
+
+	omp_set_num_threads(ompThreads());
+#pragma omp parallel for schedule(dynamic)
+	for (int i = 0; i < missing.size(); i++) {
+		Ped::Tflowfield *field = new Ped::Tflowfield(WORLD_SIZE, WORLD_SIZE);
+		field->build(waypoints[missing[i]], obstacleGrid);
+		flowFields[missing[i]] = field;
+	}
+}
+
+void Ped::Model::tick_FLOWFIELD() {
+	omp_set_num_threads(ompThreads());
+
+	// Update destinations and note which waypoints still lack a field
+#pragma omp parallel for
+	for (int i = 0; i < agents.size(); i++) {
+		agents[i]->destination = agents[i]->getNextDestination();
+		if (agents[i]->destination != NULL) {
+			int slot = agents[i]->destination->getid() - firstWaypointId;
+			if (flowFields[slot] == NULL) {
+				flowFieldRequested[slot].store(1, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	buildRequestedFlowFields();
+
+	// One lookup per agent; agents off the field walk straight
+#pragma omp parallel for
+	for (int i = 0; i < agents.size(); i++) {
+		Ped::Tagent *agent = agents[i];
+		if (!agent->isActive() || agent->destination == NULL) {
+			continue;
+		}
+		int x = agent->getX();
+		int y = agent->getY();
+		int stepX, stepY;
+		const Ped::Tflowfield *field = flowFields[agent->destination->getid() - firstWaypointId];
+		if (!field->getStep(x, y, stepX, stepY)) {
+			int diffX = (int)round(agent->destination->getx()) - x;
+			int diffY = (int)round(agent->destination->gety()) - y;
+			stepX = Ped::unitStep(diffX, diffY);
+			stepY = Ped::unitStep(diffY, diffX);
+		}
+		agent->setDesiredPosition(x + stepX, y + stepY);
+		agent->setX(x + stepX);
+		agent->setY(y + stepY);
+	}
+}
+
+// xorshift32, so that spawning is reproducible and never allocates
+static unsigned int nextRandom(unsigned int &state) {
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+void Ped::Model::syncAgentSIMD(int i) {
+	const int agentX = agents[i]->getX();
+	const int agentY = agents[i]->getY();
+	agentsSIMD.x[i] = agentX;
+	agentsSIMD.y[i] = agentY;
+	agentsSIMD.desiredX[i] = agentX;
+	agentsSIMD.desiredY[i] = agentY;
+	((int *)&x[i / 4])[i % 4] = agentX;
+	((int *)&y[i / 4])[i % 4] = agentY;
+	((int *)&desiredX[i / 4])[i % 4] = agentX;
+	((int *)&desiredY[i / 4])[i % 4] = agentY;
+}
+
+void Ped::Model::despawnAgent(int slot) {
+	Ped::Tagent *agent = agents[slot];
+	const int agentX = agent->getX();
+	const int agentY = agent->getY();
+	if (agentX >= 0 && agentX < WORLD_SIZE && agentY >= 0 && agentY < WORLD_SIZE && coordinates[agentX][agentY] == agent->getId()) {
+		coordinates[agentX][agentY] = -1;
+		releaseCell(agentX, agentY);
+	}
+	if (agent->getMacroBlock() >= 0) {
+		removeFromMacro(agent);
+	}
+	else if (usesRegions()) {
+		removeFromRegion(agent);
+	}
+	if (tree != NULL) {
+		tree->remove(agent);
+	}
+	if (agent->getLodBlock() >= 0) {
+		// It stays listed until the level of detail next looks at it
+		lodOccupancy[agent->getLodBlock()]--;
+		agent->setLodBlock(-1);
+	}
+	agent->deactivate();
+
+	if (slotSource[slot] != -1) {
+		sourceAlive[slotSource[slot]]--;
+		slotSource[slot] = -1;
+	}
+	freeSlots.push_back(slot);
+}
+
+bool Ped::Model::spawnAgent(int sourceIndex) {
+	const Ped::Tsource *source = sources[sourceIndex];
+	const int width = std::max((int)source->getdx(), 1);
+	const int height = std::max((int)source->getdy(), 1);
+	const int left = (int)round(source->getx() - source->getdx() / 2);
+	const int top = (int)round(source->gety() - source->getdy() / 2);
+
+	// A few random picks; if the area is crowded, try again next tick
+	for (int attempt = 0; attempt < 8; attempt++) {
+		const int spawnX = left + nextRandom(spawnRandom) % width;
+		const int spawnY = top + nextRandom(spawnRandom) % height;
+		if (spawnX < 0 || spawnX >= WORLD_SIZE || spawnY < 0 || spawnY >= WORLD_SIZE || obstacleGrid.isBlocked(spawnX, spawnY)) {
+			continue;
+		}
+
+		// Only the collision backends keep coordinates up to date, so
+		// check that the agent listed there is really still standing here
+		const long occupant = coordinates[spawnX][spawnY];
+		if (occupant != -1 && agents[occupant]->isActive() && agents[occupant]->getX() == spawnX && agents[occupant]->getY() == spawnY) {
+			continue;
+		}
+
+		const int slot = freeSlots.back();
+		freeSlots.pop_back();
+		Ped::Tagent *agent = agents[slot];
+		agent->activate(spawnX, spawnY);
+		const std::vector<Ped::Twaypoint*> &waypoints = source->getWaypoints();
+		for (int i = 0; i < waypoints.size(); i++) {
+			agent->addWaypoint(waypoints[i]);
+		}
+
+		coordinates[spawnX][spawnY] = agent->getId();
+		if (usesRegions()) {
+			addToRegion(agent, regionOf(spawnX, spawnY));
+		}
+		placeAgent(agent);
+		if (levelOfDetail) {
+			lodCount(agent);
+			if (agent->getLodList() == Tagent::LOD_UNLISTED) {
+				agent->setLodList(Tagent::LOD_DENSE);
+				lodDense.push_back(agent);
+			}
+		}
+		syncAgentSIMD(slot);
+		slotSource[slot] = sourceIndex;
+		sourceAlive[sourceIndex]++;
+		return true;
+	}
+	return false;
+}
+
+void Ped::Model::updateSpawning() {
+	// Agents standing in a sink leave; their slots go back on the free list
+	if (!sinks.empty()) {
+		for (int i = 0; i < agents.size(); i++) {
+			if (!agents[i]->isActive()) {
+				continue;
+			}
+			for (int s = 0; s < sinks.size(); s++) {
+				if (sinks[s]->contains(agents[i]->getX(), agents[i]->getY())) {
+					despawnAgent(i);
+					break;
+				}
+			}
+		}
+	}
+
+	// Every source earns rate agents per tick and spawns the whole ones
+	for (int s = 0; s < sources.size(); s++) {
+		const Ped::Tsource *source = sources[s];
+		spawnCredit[s] = std::min(spawnCredit[s] + source->getRate(), (double)std::max(source->getMax(), 1));
+		while (spawnCredit[s] >= 1 && sourceAlive[s] < source->getMax() && !freeSlots.empty()) {
+			if (!spawnAgent(s)) {
+				break;
+			}
+			spawnCredit[s] -= 1;
+		}
+	}
+}
+
 class Region {
 public:
 	int lowerX;
@@ -288,105 +633,392 @@ public:
 	}
 };
 
-void Ped::Model::collision_detection_regions() {
-	omp_set_num_threads(4);
+void Ped::Model::setNumThreads(int threads) {
+	numThreads = std::max(threads, 0);
 
-#pragma omp parallel
-	{
-#pragma omp sections nowait
-		{
-#pragma omp section
-			{
-				regionTask(region1);
-			}
-#pragma omp section
-			{
-				regionTask(region2);
-			}
-#pragma omp section
-			{
-				regionTask(region3);
-			}
-#pragma omp section
-			{
-				regionTask(region4);
-			}
+	// The scheduler is started again with the new count when next needed
+	delete scheduler;
+	scheduler = NULL;
+}
+
+void Ped::Model::setStageTiming(bool enabled) {
+	stageTiming = enabled;
+	tickFunction = pipelineFor(implementation, stageTiming);
+	for (int i = 0; i < STAGE_COUNT; i++) {
+		stageSeconds[i] = -1;
+	}
+}
+
+void Ped::Model::setStageCounting(bool enabled) {
+	stageCounting = enabled;
+	for (int stage = 0; stage < STAGE_COUNT; stage++) {
+		clearStageCounts((STAGE)stage);
+	}
+}
+
+void Ped::Model::setLevelOfDetail(bool enabled) {
+	levelOfDetail = enabled;
+	for (int i = 0; i < agents.size(); i++) {
+		agents[i]->setLodBlock(-1);
+		agents[i]->setLodList(enabled ? Tagent::LOD_DENSE : Tagent::LOD_UNLISTED);
+	}
+	if (enabled) {
+		rebuildLevelOfDetail();
+	}
+	else {
+		lodOccupancy.clear();
+		lodDense.clear();
+		lodSparse.clear();
+	}
+}
+
+int Ped::Model::lodBlockOf(int x, int y) const {
+	int column = std::min(std::max(x, 0), WORLD_SIZE - 1) / LOD_BLOCK;
+	int row = std::min(std::max(y, 0), WORLD_SIZE - 1) / LOD_BLOCK;
+	return row * lodBlocksPerSide + column;
+}
+
+bool Ped::Model::lodIsolated(const Tagent *agent) const {
+	const int block = agent->getLodBlock();
+	const int column = block % lodBlocksPerSide;
+	const int row = block / lodBlocksPerSide;
+	int count = 0;
+	for (int r = std::max(row - 1, 0); r <= std::min(row + 1, lodBlocksPerSide - 1); r++) {
+		for (int c = std::max(column - 1, 0); c <= std::min(column + 1, lodBlocksPerSide - 1); c++) {
+			count += lodOccupancy[r * lodBlocksPerSide + c];
 		}
 	}
+	return count == 1;
+}
 
+void Ped::Model::lodCount(Tagent *agent) {
+	const int block = lodBlockOf(agent->getX(), agent->getY());
+	if (block == agent->getLodBlock()) {
+		return;
+	}
+	if (agent->getLodBlock() >= 0) {
+		lodOccupancy[agent->getLodBlock()]--;
+	}
+	lodOccupancy[block]++;
+	agent->setLodBlock(block);
+}
 
-	// TODO: do something more efficient than this?
-	region1.clear();
-	region2.clear();
-	region3.clear();
-	region4.clear();
+void Ped::Model::rebuildLevelOfDetail() {
+	lodBlocksPerSide = (WORLD_SIZE + LOD_BLOCK - 1) / LOD_BLOCK;
+	lodOccupancy.assign(lodBlocksPerSide * lodBlocksPerSide, 0);
+
+	// Room for every agent in every list, so spawning and switching
+	// lists never allocate
+	lodDense.clear();
+	lodDense.reserve(agents.size());
+	lodScratch.reserve(agents.size());
+	lodSparse.resize(LOD_INTERVAL);
+	for (int i = 0; i < LOD_INTERVAL; i++) {
+		lodSparse[i].clear();
+		lodSparse[i].reserve(agents.size());
+	}
 
-	// Update the agents new region based on new X and Y values and region sets
 	for (int i = 0; i < agents.size(); i++) {
-		if (agents[i]->getX() < 100) {
-			if (agents[i]->getY() < 60) {
-				region1.insert(agents[i]);
-				agents[i]->setRegionId(1);
-			}
-			else {
-				region3.insert(agents[i]);
-				agents[i]->setRegionId(3);
-			}
+		Ped::Tagent *agent = agents[i];
+		agent->setLodBlock(-1);
+		if (!agent->isActive()) {
+			agent->setLodList(Tagent::LOD_UNLISTED);
+			continue;
+		}
+		lodCount(agent);
+		if (agent->getLodList() >= 0) {
+			lodSparse[agent->getLodList()].push_back(agent);
 		}
 		else {
-			if (agents[i]->getY() < 60) {
-				region2.insert(agents[i]);
-				agents[i]->setRegionId(2);
-			}
-			else {
-				region4.insert(agents[i]);
-				agents[i]->setRegionId(4);
+			agent->setLodList(Tagent::LOD_DENSE);
+			lodDense.push_back(agent);
+		}
+	}
+}
+
+void Ped::Model::classifyLevelOfDetail() {
+	// The isolated agents due this tick that still are stay in their
+	// list and move LOD_INTERVAL steps; the others are moved every tick
+	// from now on. Agents that left the simulation are dropped.
+	std::vector<Tagent*> &due = lodSparse[lodTick];
+	lodScratch.clear();
+	size_t kept = 0;
+	for (size_t i = 0; i < due.size(); i++) {
+		Ped::Tagent *agent = due[i];
+		if (!agent->isActive()) {
+			agent->setLodList(Tagent::LOD_UNLISTED);
+		}
+		else if (lodIsolated(agent)) {
+			due[kept++] = agent;
+		}
+		else {
+			agent->setLodList(Tagent::LOD_DENSE);
+			lodScratch.push_back(agent);
+		}
+	}
+	due.resize(kept);
+
+	// Dense agents that became isolated join them. Their first move
+	// takes them where they will be at the end of the cycle, so they
+	// are never behind the agents moved every tick.
+	for (size_t i = 0; i < lodDense.size(); i++) {
+		Ped::Tagent *agent = lodDense[i];
+		if (!agent->isActive()) {
+			agent->setLodList(Tagent::LOD_UNLISTED);
+		}
+		else if (lodIsolated(agent)) {
+			agent->setLodList(lodTick);
+			due.push_back(agent);
+		}
+		else {
+			lodScratch.push_back(agent);
+		}
+	}
+	lodDense.swap(lodScratch);
+}
+
+void Ped::Model::clearStageCounts(STAGE stage) {
+	for (int counter = 0; counter < Tperfcounters::COUNTER_COUNT; counter++) {
+		stageCounts[stage][counter] = 0;
+	}
+}
+
+void Ped::Model::addStageCounts(STAGE stage, const unsigned long long before[Tperfcounters::COUNTER_COUNT]) {
+	unsigned long long after[Tperfcounters::COUNTER_COUNT];
+	Tperfcounters::read(after);
+	for (int counter = 0; counter < Tperfcounters::COUNTER_COUNT; counter++) {
+		stageCounts[stage][counter] += after[counter] - before[counter];
+	}
+}
+
+void Ped::Model::setMetrics(Tmetrics *metrics) {
+	this->metrics = metrics;
+	if (metrics != NULL && !stageTiming) {
+		setStageTiming(true);
+	}
+}
+
+void Ped::Model::reportMetrics(std::chrono::steady_clock::time_point tickStart) {
+	metrics->record(Tmetrics::TICK_LATENCY, std::chrono::duration<double>(std::chrono::steady_clock::now() - tickStart).count());
+	if (stageSeconds[MOVEMENT_STAGE] >= 0) {
+		metrics->record(Tmetrics::MOVEMENT_LATENCY, stageSeconds[MOVEMENT_STAGE]);
+	}
+	if (stageSeconds[HEATMAP_STAGE] >= 0) {
+		metrics->record(Tmetrics::HEATMAP_LATENCY, stageSeconds[HEATMAP_STAGE]);
+	}
+	metrics->add(Tmetrics::TICKS);
+	metrics->setAgentCount(static_cast<int>(agents.size() - freeSlots.size()));
+}
+
+bool Ped::Model::usesRegions() const {
+	return implementation == REGION || implementation == HEATMAP_SEQ || implementation == CPU_GPU;
+}
+
+Ped::Tscheduler &Ped::Model::taskScheduler() {
+	if (scheduler == NULL) {
+		scheduler = new Ped::Tscheduler(numThreads);
+	}
+	return *scheduler;
+}
+
+void Ped::Model::collision_detection_regions() {
+	refreshHalos();
+
+	auto body = [this](int region) {
+		if (countingMovement) {
+			unsigned long long before[Tperfcounters::COUNTER_COUNT];
+			Tperfcounters::read(before);
+			regionTask(region);
+			addStageCounts(MOVEMENT_STAGE, before);
+		}
+		else {
+			regionTask(region);
+		}
+	};
+	taskScheduler().run(static_cast<int>(regions.size()), regionDependencies.data(), regionSuccessorStart.data(), regionSuccessors.data(), body);
+
+	// Move the agents that crossed a region border this tick
+	migrateAgents();
+}
+
+int Ped::Model::regionOf(int x, int y) const {
+	int column = std::min(std::max(x, 0), WORLD_SIZE - 1) / REGION_SIZE;
+	int row = std::min(std::max(y, 0), WORLD_SIZE - 1) / REGION_SIZE;
+	return row * regionsPerSide + column;
+}
+
+void Ped::Model::setupRegions() {
+	regionsPerSide = (WORLD_SIZE + REGION_SIZE - 1) / REGION_SIZE;
+	const int count = regionsPerSide * regionsPerSide;
+	regions = vector<vector<Tagent *>>(count);
+	halos = vector<vector<HaloAgent>>(count);
+	emigrants = vector<vector<Tagent *>>(count);
+	regionAwake.assign(count, 0);
+	cellWatchers.assign(WORLD_SIZE * WORLD_SIZE, 0);
+
+	// With collision handling a region holds at most one agent per cell,
+	// and only agents next to its border can leave it or show up in a
+	// neighbor's halo. Room for that many means ticks never grow these.
+	for (int region = 0; region < count; region++) {
+		regions[region].reserve(REGION_SIZE * REGION_SIZE);
+		halos[region].reserve((REGION_SIZE + 2 * HALO_WIDTH) * (REGION_SIZE + 2 * HALO_WIDTH) - REGION_SIZE * REGION_SIZE);
+		emigrants[region].reserve(4 * REGION_SIZE);
+	}
+
+	regionDependencies.assign(count, 0);
+	regionSuccessorStart.assign(count + 1, 0);
+	regionSuccessors.clear();
+	for (int region = 0; region < count; region++) {
+		const int column = region % regionsPerSide;
+		const int row = region / regionsPerSide;
+		const int color = (row % 2) * 2 + column % 2;
+		regionSuccessorStart[region] = static_cast<int>(regionSuccessors.size());
+		for (int dy = -1; dy <= 1; dy++) {
+			for (int dx = -1; dx <= 1; dx++) {
+				const int nx = column + dx;
+				const int ny = row + dy;
+				if ((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= regionsPerSide || ny >= regionsPerSide) {
+					continue;
+				}
+				const int neighborColor = (ny % 2) * 2 + nx % 2;
+				if (neighborColor < color) {
+					regionDependencies[region]++;
+				}
+				else {
+					regionSuccessors.push_back(ny * regionsPerSide + nx);
+				}
 			}
+		}
+	}
+	regionSuccessorStart[count] = static_cast<int>(regionSuccessors.size());
+}
+
+void Ped::Model::assignRegions() {
+	for (int i = 0; i < regions.size(); i++) {
+		regions[i].clear();
+	}
+	std::fill(regionAwake.begin(), regionAwake.end(), 0);
 
+	for (int i = 0; i < agents.size(); i++) {
+		// Agents carried by the hybrid model's blocks are in no region
+		if (!agents[i]->isActive() || agents[i]->getMacroBlock() >= 0) {
+			continue;
 		}
+		addToRegion(agents[i], regionOf(agents[i]->getX(), agents[i]->getY()));
 	}
 }
 
+void Ped::Model::addToRegion(Tagent *agent, int region) {
+	agent->setRegionId(region);
+	agent->setRegionIndex(static_cast<int>(regions[region].size()));
+	regions[region].push_back(agent);
+	if (!agent->isAsleep()) {
+		regionAwake[region]++;
+	}
+}
 
-void Ped::Model::regionTask(set<Tagent*> region) {
-	for (set<Tagent *>::iterator it = region.begin(); it != region.end(); ++it) {
-		(*it)->computeNextDesiredPosition();
-		moveRegions(*it);
+void Ped::Model::removeFromRegion(Tagent *agent) {
+	if (!agent->isAsleep()) {
+		regionAwake[agent->getRegionId()]--;
 	}
+
+	// Move the region's last agent into the gap
+	vector<Tagent *> &region = regions[agent->getRegionId()];
+	Ped::Tagent *last = region.back();
+	region[agent->getRegionIndex()] = last;
+	last->setRegionIndex(agent->getRegionIndex());
+	region.pop_back();
 }
 
-void Ped::Model::tick()
-{
-	if (this->implementation == SEQ) {
-		//Serial Code
-		for (int i = 0; i < agents.size(); i++) {
-			agents[i]->computeNextDesiredPosition();
-			int newX = agents[i]->getDesiredX();
-			int newY = agents[i]->getDesiredY();
-			agents[i]->setX(newX);
-			agents[i]->setY(newY);
-			//move(agents[i]);
+void Ped::Model::migrateAgents() {
+	for (int region = 0; region < emigrants.size(); region++) {
+		for (int i = 0; i < emigrants[region].size(); i++) {
+			Ped::Tagent *agent = emigrants[region][i];
+			removeFromRegion(agent);
+			addToRegion(agent, regionOf(agent->getX(), agent->getY()));
 		}
+		emigrants[region].clear();
+	}
+}
 
-		/*vector<Region> regions = vector<Region>();
-		regions.push_back(Region(0, 99, 0, 59));
-		regions.push_back(Region(100, 199, 0, 59));
-		regions.push_back(Region(0, 99, 60, 119));
-		regions.push_back(Region(100, 199, 60, 119));*/
 
+void Ped::Model::refreshHalos() {
+	for (int i = 0; i < halos.size(); i++) {
+		halos[i].clear();
 	}
-	else if (this->implementation == OMP) {
-		// OpenMP Code
-		omp_set_num_threads(4);
-#pragma omp parallel for
-		for (int i = 0; i < agents.size(); i++) {
-			agents[i]->computeNextDesiredPosition();
-			int newX = agents[i]->getDesiredX();
-			int newY = agents[i]->getDesiredY();
-			agents[i]->setX(newX);
-			agents[i]->setY(newY);
+
+	for (int region = 0; region < regions.size(); region++) {
+		const int column = region % regionsPerSide;
+		const int row = region / regionsPerSide;
+		for (int i = 0; i < regions[region].size(); i++) {
+			const Ped::Tagent *agent = regions[region][i];
+			// Agents that reached a sink block no one
+			if (!agent->isActive()) {
+				continue;
+			}
+			const int agentX = agent->getX();
+			const int agentY = agent->getY();
+			const Ped::HaloAgent copy = { agentX, agentY, agent->getId() };
+
+			// Hand the agent to every neighboring region it is close to
+			for (int dy = -1; dy <= 1; dy++) {
+				for (int dx = -1; dx <= 1; dx++) {
+					const int nx = column + dx;
+					const int ny = row + dy;
+					if ((dx == 0 && dy == 0) || nx < 0 || ny < 0 || nx >= regionsPerSide || ny >= regionsPerSide) {
+						continue;
+					}
+					if (agentX < nx * REGION_SIZE - HALO_WIDTH || agentX >= (nx + 1) * REGION_SIZE + HALO_WIDTH
+						|| agentY < ny * REGION_SIZE - HALO_WIDTH || agentY >= (ny + 1) * REGION_SIZE + HALO_WIDTH) {
+						continue;
+					}
+					halos[ny * regionsPerSide + nx].push_back(copy);
+				}
+			}
+		}
+	}
+}
+
+void Ped::Model::regionTask(int region) {
+	// Only agents of touching regions wake agents of this one, and none
+	// of them runs now, so the count can't change under us
+	if (regionAwake[region] == 0) {
+		return;
+	}
+
+	const vector<Tagent *> &members = regions[region];
+	for (int i = 0; i < members.size(); i++) {
+		Ped::Tagent *agent = members[i];
+		if (agent->isAsleep()) {
+			continue;
+		}
+		agent->computeNextDesiredPosition();
+		moveRegions(agent);
+
+		// The agent stays listed here until migrateAgents(), so a region
+		// that runs later doesn't move it a second time
+		if (regionOf(agent->getX(), agent->getY()) != region) {
+			emigrants[region].push_back(agent);
 		}
 	}
+}
+
+void Ped::Model::tick()
+{
+	std::chrono::steady_clock::time_point tickStart;
+	if (metrics != NULL) {
+		tickStart = std::chrono::steady_clock::now();
+	}
+
+	heatmapDirtyRects.clear();
+
+	if (!sources.empty() || !sinks.empty()) {
+		updateSpawning();
+	}
+
+	if (tickFunction != NULL) {
+		(this->*tickFunction)();
+	}
 	else if (this->implementation == VECTOR) {
 		// SIMD
 		tick_SIMD();
@@ -395,17 +1027,24 @@ void Ped::Model::tick()
 		// SIMD + OpenMP
 		tick_SIMDOMP();
 	}
+	else if (this->implementation == INTSTEP) {
+		// Integer-only SIMD
+		tick_INTSTEP();
+	}
+	else if (this->implementation == FLOWFIELD) {
+		// Shared per-waypoint flow fields + OpenMP
+		tick_FLOWFIELD();
+	}
 	else if (this->implementation == PTHREAD) {
-		// Pthread C++ Code
-		const int NUM_THREADS = 1;
-		thread threads[NUM_THREADS];
-		for (int i = 0; i < NUM_THREADS; i++) {
-			threads[i] = thread(thread_imp, i, agents, NUM_THREADS);
-		}
-
-		for (int i = 0; i < NUM_THREADS; i++) {
-			threads[i].join();
+		// Pthread C++ Code, on the scheduler's long-lived threads:
+		// starting a std::thread allocates its state every tick
+		const int NUM_THREADS = numThreads > 0 ? numThreads : 1;
+		if (pthreadGraph.size() != NUM_THREADS + 1) {
+			// Independent slices: no dependencies, no successors
+			pthreadGraph.assign(NUM_THREADS + 1, 0);
 		}
+		auto body = [this, NUM_THREADS](int i) { thread_imp(i, agents, NUM_THREADS); };
+		taskScheduler().run(NUM_THREADS, pthreadGraph.data(), pthreadGraph.data(), pthreadGraph.data(), body);
 	}
 	else if (this->implementation == CUDA) {
 		// CUDA
@@ -424,6 +1063,9 @@ void Ped::Model::tick()
 			agentsSIMD.desiredX, agentsSIMD.desiredY, agents.size());
 
 		for (int i = 0; i < agents.size(); i++) {
+			if (!agents[i]->isActive()) {
+				continue;
+			}
 			agentsSIMD.desiredX[i] = ret.desiredX[i];
 			agentsSIMD.desiredY[i] = ret.desiredY[i];
 			agentsSIMD.x[i] = ret.desiredX[i];
@@ -432,32 +1074,185 @@ void Ped::Model::tick()
 			agents[i]->setY(ret.desiredY[i]);
 		}
 	}
-	else if (this->implementation == SEQCOLLISION) {
-		for (int i = 0; i < agents.size(); i++) {
-			agents[i]->computeNextDesiredPosition();
-			move(agents[i]);
+	else if (this->implementation == CPU_GPU) {
+		updateHeatmapCUDA(this);
+	}
+
+	cleanup();
+
+	if (exporter != NULL) {
+		exporter->publish(*this);
+	}
+
+	if (metrics != NULL) {
+		reportMetrics(tickStart);
+	}
+}
+
+Ped::Model::TickFunction Ped::Model::pipelineFor(IMPLEMENTATION implementation, bool timed)
+{
+	switch (implementation) {
+	case SEQ:
+		return pipeline<SequentialMovement, NoCollision, NoHeatmap>(timed);
+	case OMP:
+		return pipeline<ParallelMovement, NoCollision, NoHeatmap>(timed);
+	case SEQCOLLISION:
+		return pipeline<SequentialMovement, Collision, NoHeatmap>(timed);
+	case SEQCOLLISIONOMP:
+		return pipeline<ParallelMovement, Collision, NoHeatmap>(timed);
+	case REGION:
+		return pipeline<RegionMovement, Collision, NoHeatmap>(timed);
+	case HEATMAP_SEQ:
+		return pipeline<RegionMovement, Collision, SequentialHeatmap>(timed);
+	default:
+		return NULL;
+	}
+}
+
+template<typename Movement, typename CollisionPolicy, typename HeatmapPolicy>
+Ped::Model::TickFunction Ped::Model::pipeline(bool timed)
+{
+	if (timed) {
+		return &Model::tickPipeline<Movement, CollisionPolicy, HeatmapPolicy, StageTiming>;
+	}
+	return &Model::tickPipeline<Movement, CollisionPolicy, HeatmapPolicy, NoInstrumentation>;
+}
+
+template<typename CollisionPolicy>
+inline void Ped::Model::stepAgent(Tagent *agent)
+{
+	if (!agent->isActive()) {
+		return;
+	}
+	agent->computeNextDesiredPosition();
+	if (CollisionPolicy::enabled) {
+		move(agent);
+	}
+	else {
+		agent->setX(agent->getDesiredX());
+		agent->setY(agent->getDesiredY());
+	}
+}
+
+template<typename Movement>
+void Ped::Model::moveLevelOfDetail(bool counting)
+{
+	classifyLevelOfDetail();
+
+	// Only the dense agents and the isolated ones due this tick are
+	// touched, so a tick costs about dense + isolated / LOD_INTERVAL moves
+	const std::vector<Tagent*> &due = lodSparse[lodTick];
+	const int denseCount = static_cast<int>(lodDense.size());
+	const int dueCount = static_cast<int>(due.size());
+	if (Movement::parallel) {
+		omp_set_num_threads(ompThreads());
+	}
+#pragma omp parallel if(Movement::parallel)
+	{
+		unsigned long long threadBefore[Tperfcounters::COUNTER_COUNT];
+		if (counting) {
+			Tperfcounters::read(threadBefore);
+		}
+#pragma omp for
+		for (int i = 0; i < denseCount; i++) {
+			stepAgent<Collision>(lodDense[i]);
+		}
+#pragma omp for
+		for (int i = 0; i < dueCount; i++) {
+			advanceIsolated(due[i]);
+		}
+		if (counting) {
+			addStageCounts(MOVEMENT_STAGE, threadBefore);
 		}
 	}
-	else if (this->implementation == SEQCOLLISIONOMP) {
-		omp_set_num_threads(4);
-#pragma omp parallel for
-		for (int i = 0; i < agents.size(); i++) {
-			agents[i]->computeNextDesiredPosition();
-			move(agents[i]);
+
+	for (int i = 0; i < denseCount; i++) {
+		lodCount(lodDense[i]);
+	}
+	for (int i = 0; i < dueCount; i++) {
+		lodCount(due[i]);
+	}
+	lodTick = (lodTick + 1) % LOD_INTERVAL;
+}
+
+// The policy checks are all compile-time constants, so each
+// instantiation keeps only the branches its policies select
+template<typename Movement, typename CollisionPolicy, typename HeatmapPolicy, typename InstrumentationPolicy>
+void Ped::Model::tickPipeline()
+{
+	static_assert(!Movement::regions || CollisionPolicy::enabled, "region movement always resolves collisions");
+
+	// With counting on, every thread that works on a stage reads its
+	// counters around its share of the work
+	const bool counting = InstrumentationPolicy::enabled && stageCounting;
+	unsigned long long before[Tperfcounters::COUNTER_COUNT];
+
+	std::chrono::steady_clock::time_point start;
+	if (InstrumentationPolicy::enabled) {
+		start = std::chrono::steady_clock::now();
+		if (counting) {
+			clearStageCounts(MOVEMENT_STAGE);
+			clearStageCounts(HEATMAP_STAGE);
 		}
 	}
-	else if (this->implementation == REGION) {
+
+	if (Movement::regions) {
+		if (HeatmapPolicy::enabled && hybrid) {
+			updateHybrid();
+		}
+		countingMovement = counting;
 		collision_detection_regions();
+		countingMovement = false;
 	}
-	else if (this->implementation == HEATMAP_SEQ) {
-		collision_detection_regions();
-		auto start = std::chrono::steady_clock::now();
-		updateHeatmapSeq();
-		auto duration_target = std::chrono::duration_cast<std::chrono::milliseconds> (std::chrono::steady_clock::now() - start);
-		cout << "Target time: " << duration_target.count() << " milliseconds, " << std::endl;
+	else if (CollisionPolicy::enabled && levelOfDetail) {
+		moveLevelOfDetail<Movement>(counting);
 	}
-	else if (this->implementation == CPU_GPU) {
-		updateHeatmapCUDA(this);
+	else if (Movement::parallel) {
+		omp_set_num_threads(ompThreads());
+#pragma omp parallel
+		{
+			unsigned long long threadBefore[Tperfcounters::COUNTER_COUNT];
+			if (counting) {
+				Tperfcounters::read(threadBefore);
+			}
+#pragma omp for
+			for (int i = 0; i < agents.size(); i++) {
+				stepAgent<CollisionPolicy>(agents[i]);
+			}
+			if (counting) {
+				addStageCounts(MOVEMENT_STAGE, threadBefore);
+			}
+		}
+	}
+	else {
+		if (counting) {
+			Tperfcounters::read(before);
+		}
+		for (int i = 0; i < agents.size(); i++) {
+			stepAgent<CollisionPolicy>(agents[i]);
+		}
+		if (counting) {
+			addStageCounts(MOVEMENT_STAGE, before);
+		}
+	}
+
+	if (InstrumentationPolicy::enabled) {
+		std::chrono::steady_clock::time_point moved = std::chrono::steady_clock::now();
+		stageSeconds[MOVEMENT_STAGE] = std::chrono::duration<double>(moved - start).count();
+		start = moved;
+	}
+
+	if (HeatmapPolicy::enabled) {
+		if (counting) {
+			Tperfcounters::read(before);
+		}
+		updateHeatmapSeq();
+		if (InstrumentationPolicy::enabled) {
+			stageSeconds[HEATMAP_STAGE] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		}
+		if (counting) {
+			addStageCounts(HEATMAP_STAGE, before);
+		}
 	}
 }
 
@@ -467,70 +1262,119 @@ void Ped::Model::tick()
 ///////////////////////////////////////////////
 
 
-// Moves the agent to the next desired position. If already taken, it will
-// be moved to a location close to it.
-void Ped::Model::move(Ped::Tagent *agent)
+// Computes the three alternative positions that would bring the agent
+// closer to his desiredPosition, starting with the desiredPosition itself
+void Ped::Model::prioritizedAlternatives(const Ped::Tagent *agent, std::pair<int, int> alternatives[3])
 {
-	// Search for neighboring agents
-	set<const Ped::Tagent *> neighbors = getNeighbors(agent->getX(), agent->getY(), 2);
-
-	// Retrieve their positions
-	std::vector<std::pair<int, int> > takenPositions;
-	for (std::set<const Ped::Tagent*>::iterator neighborIt = neighbors.begin(); neighborIt != neighbors.end(); ++neighborIt) {
-		std::pair<int, int> position((*neighborIt)->getX(), (*neighborIt)->getY());
-		takenPositions.push_back(position);
-	}
-
-	// Compute the three alternative positions that would bring the agent
-	// closer to his desiredPosition, starting with the desiredPosition itself
-	std::vector<std::pair<int, int> > prioritizedAlternatives;
 	std::pair<int, int> pDesired(agent->getDesiredX(), agent->getDesiredY());
-	prioritizedAlternatives.push_back(pDesired);
+	alternatives[0] = pDesired;
 
 	int diffX = pDesired.first - agent->getX();
 	int diffY = pDesired.second - agent->getY();
-	std::pair<int, int> p1, p2;
 	if (diffX == 0 || diffY == 0)
 	{
 		// Agent wants to walk straight to North, South, West or East
-		p1 = std::make_pair(pDesired.first + diffY, pDesired.second + diffX);
-		p2 = std::make_pair(pDesired.first - diffY, pDesired.second - diffX);
+		alternatives[1] = std::make_pair(pDesired.first + diffY, pDesired.second + diffX);
+		alternatives[2] = std::make_pair(pDesired.first - diffY, pDesired.second - diffX);
 	}
 	else {
 		// Agent wants to walk diagonally
-		p1 = std::make_pair(pDesired.first, agent->getY());
-		p2 = std::make_pair(agent->getX(), pDesired.second);
+		alternatives[1] = std::make_pair(pDesired.first, agent->getY());
+		alternatives[2] = std::make_pair(agent->getX(), pDesired.second);
 	}
-	prioritizedAlternatives.push_back(p1);
-	prioritizedAlternatives.push_back(p2);
+}
+
+// Moves the agent to the next desired position. If already taken, it will
+// be moved to a location close to it.
+void Ped::Model::move(Ped::Tagent *agent)
+{
+	// Retrieve the positions of the neighboring agents
+	Ped::NeighborBuffer takenPositions;
+	queryNeighbors(agent->getX(), agent->getY(), 2, takenPositions);
+
+	std::pair<int, int> alternatives[3];
+	prioritizedAlternatives(agent, alternatives);
 
 	// Find the first empty alternative position
-	for (std::vector<pair<int, int> >::iterator it = prioritizedAlternatives.begin(); it != prioritizedAlternatives.end(); ++it) {
+	for (int i = 0; i < 3; i++) {
+
+		// Never walk into a wall
+		if (obstacleGrid.isBlocked(alternatives[i].first, alternatives[i].second)) {
+			continue;
+		}
 
 		// If the current position is not yet taken by any neighbor
-		if (std::find(takenPositions.begin(), takenPositions.end(), *it) == takenPositions.end()) {
+		if (!takenPositions.contains(alternatives[i].first, alternatives[i].second)) {
 
 			// Set the agent's position 
-			agent->setX((*it).first);
-			agent->setY((*it).second);
+			agent->setX(alternatives[i].first);
+			agent->setY(alternatives[i].second);
 
-			break;
+			if (metrics != NULL && i > 0) {
+				metrics->add(Tmetrics::COLLISION_RETRIES);
+			}
+			return;
 		}
 	}
+
+	if (metrics != NULL) {
+		metrics->add(Tmetrics::COLLISION_FAILURES);
+	}
 }
 
-/// Returns the list of neighbors within dist of the point x/y. This
-/// can be the position of an agent, but it is not limited to this.
-/// \date    2012-01-29
-/// \return  The list of neighbors
+// Like move(), LOD_INTERVAL times over. Nobody is near enough to be in
+// the way (see LOD_INTERVAL), so only the walls are checked.
+void Ped::Model::advanceIsolated(Ped::Tagent *agent)
+{
+	std::pair<int, int> alternatives[3];
+	for (int step = 0; step < LOD_INTERVAL; step++) {
+		agent->computeNextDesiredPosition();
+		prioritizedAlternatives(agent, alternatives);
+
+		int i = 0;
+		while (i < 3 && obstacleGrid.isBlocked(alternatives[i].first, alternatives[i].second)) {
+			i++;
+		}
+		if (i == 3) {
+			if (metrics != NULL) {
+				metrics->add(Tmetrics::COLLISION_FAILURES);
+			}
+			continue;
+		}
+		agent->setX(alternatives[i].first);
+		agent->setY(alternatives[i].second);
+		if (metrics != NULL && i > 0) {
+			metrics->add(Tmetrics::COLLISION_RETRIES);
+		}
+	}
+}
+
+/// Writes the positions of the agents within dist of the point x/y
+/// into out. This can be the position of an agent, but it is not
+/// limited to this; an agent standing at x/y itself is left out.
 /// \param   x the x coordinate
 /// \param   y the y coordinate
-/// \param   dist the distance around x/y that will be searched for agents (search field is a square in the current implementation)
-set<const Ped::Tagent*> Ped::Model::getNeighbors(int x, int y, int dist) const {
+/// \param   dist the Manhattan distance around x/y that will be searched for agents
+/// \param   out the buffer the positions are written to
+void Ped::Model::queryNeighbors(int x, int y, int dist, NeighborBuffer &out) const {
+	out.clear();
+
+	// Only the leaves of the tree around x/y are looked at
+	auto visit = [&](const Ped::Tagent *neighbor) {
+		if (neighbor->getX() == x && neighbor->getY() == y) {
+			return;
+		}
+		if (getDistance(neighbor->getX(), neighbor->getY(), x, y) <= dist) {
+			out.add(neighbor->getX(), neighbor->getY());
+		}
+	};
+	tree->query(x, y, dist, visit);
+}
 
-	// create the output list
-	// ( It would be better to include only the agents close by, but this programmer is lazy.)	
-	return set<const Ped::Tagent*>(agents.begin(), agents.end());
+void Ped::Model::placeAgent(const Ped::Tagent *a) {
+	if (tree != NULL) {
+		tree->insert(a);
+	}
 }
 
 
@@ -538,49 +1382,28 @@ set<const Ped::Tagent*> Ped::Model::getNeighbors(int x, int y, int dist) const {
 // be moved to a location close to it.
 void Ped::Model::moveRegions(Ped::Tagent *agent)
 {
-	// Search for neighboring agents
-	//set<const Ped::Tagent *> neighbors = getNeighbors(agent->getX(), agent->getY(), 2);
-	set<const Ped::Tagent *> neighbors = getNeighborsRegions(agent, 4);
-
-	// Retrieve their positions
-	std::vector<std::pair<int, int> > takenPositions;
-	for (std::set<const Ped::Tagent*>::iterator neighborIt = neighbors.begin(); neighborIt != neighbors.end(); ++neighborIt) {
-		std::pair<int, int> position((*neighborIt)->getX(), (*neighborIt)->getY());
-		takenPositions.push_back(position);
-	}
+	// Retrieve the positions of the neighboring agents
+	Ped::NeighborBuffer takenPositions;
+	queryNeighborsRegions(agent, 4, takenPositions);
 
-	// Compute the three alternative positions that would bring the agent
-	// closer to his desiredPosition, starting with the desiredPosition itself
-	std::vector<std::pair<int, int> > prioritizedAlternatives;
-
-	std::pair<int, int> pDesired(agent->getDesiredX(), agent->getDesiredY());
-	prioritizedAlternatives.push_back(pDesired);
-
-	int diffX = pDesired.first - agent->getX();
-	int diffY = pDesired.second - agent->getY();
-	std::pair<int, int> p1, p2;
-	if (diffX == 0 || diffY == 0)
-	{
-		// Agent wants to walk straight to North, South, West or East
-		p1 = std::make_pair(pDesired.first + diffY, pDesired.second + diffX);
-		p2 = std::make_pair(pDesired.first - diffY, pDesired.second - diffX);
-	}
-	else {
-		// Agent wants to walk diagonally
-		p1 = std::make_pair(pDesired.first, agent->getY());
-		p2 = std::make_pair(agent->getX(), pDesired.second);
-	}
-	prioritizedAlternatives.push_back(p1);
-	prioritizedAlternatives.push_back(p2);
+	std::pair<int, int> alternatives[3];
+	prioritizedAlternatives(agent, alternatives);
 
 	// Find the first empty alternative position
-	for (std::vector<pair<int, int> >::iterator it = prioritizedAlternatives.begin(); it != prioritizedAlternatives.end(); ++it) {
+	for (int i = 0; i < 3; i++) {
+		const int altX = alternatives[i].first;
+		const int altY = alternatives[i].second;
+
+		// Never walk into a wall
+		if (obstacleGrid.isBlocked(altX, altY)) {
+			continue;
+		}
 
 		// If the current position is not yet taken by any neighbor
-		if (std::find(takenPositions.begin(), takenPositions.end(), *it) == takenPositions.end()) {
+		if (!takenPositions.contains(altX, altY)) {
 
 			long newAgentId = agent->getId();
-			long oldAgentId = coordinates[(*it).first][(*it).second];
+			long oldAgentId = coordinates[altX][altY];
 
 			// If there is an agent here: try the next move (if there is one).
 			if (oldAgentId != -1) {
@@ -588,16 +1411,21 @@ void Ped::Model::moveRegions(Ped::Tagent *agent)
 			}
 
 			// If the new coordinates are free, mark them as occupied using CAS.
-			if (_InterlockedCompareExchange(&coordinates[(*it).first][(*it).second], newAgentId, oldAgentId) == oldAgentId) {
+			if (_InterlockedCompareExchange(&coordinates[altX][altY], newAgentId, oldAgentId) == oldAgentId) {
 
 				// Mark the agent's previous coordinates as free.
 				if (_InterlockedCompareExchange(&coordinates[agent->getX()][agent->getY()], -1, agent->getId()) != agent->getId()) {
 					cout << "CAS for updating free coordinate failed" << endl;
 				}
+				releaseCell(agent->getX(), agent->getY());
 
 				// Update the agent's position.
-				agent->setX((*it).first);
-				agent->setY((*it).second);
+				agent->setX(altX);
+				agent->setY(altY);
+
+				if (metrics != NULL && i > 0) {
+					metrics->add(Tmetrics::COLLISION_RETRIES);
+				}
 				return;
 			}
 			else {
@@ -605,6 +1433,85 @@ void Ped::Model::moveRegions(Ped::Tagent *agent)
 			}
 		}
 	}
+
+	if (metrics != NULL) {
+		metrics->add(Tmetrics::COLLISION_FAILURES);
+	}
+	sleepIfStuck(agent, alternatives);
+}
+
+// Bit of a cell's watchers for the agent dx, dy away from it
+static int watchBit(int dx, int dy)
+{
+	const int direction = (dy + 1) * 3 + (dx + 1);
+	return direction < 4 ? direction : direction - 1;
+}
+
+void Ped::Model::sleepIfStuck(Ped::Tagent *agent, const std::pair<int, int> alternatives[3])
+{
+	// Without a destination the agent picks a new one next tick
+	if (agent->destination == NULL) {
+		return;
+	}
+	bool watching = false;
+	for (int i = 0; i < 3; i++) {
+		const int altX = alternatives[i].first;
+		const int altY = alternatives[i].second;
+		if (altX < 0 || altX >= WORLD_SIZE || altY < 0 || altY >= WORLD_SIZE || (altX == agent->getX() && altY == agent->getY())) {
+			return;
+		}
+		if (obstacleGrid.isBlocked(altX, altY)) {
+			continue;
+		}
+		// Free, but still taken in a stale halo copy: look again next tick
+		if (coordinates[altX][altY] == -1) {
+			return;
+		}
+		watching = true;
+	}
+	if (!watching) {
+		// Walled in for good; keep trying, as before
+		return;
+	}
+
+	// The watchers of these cells and the agents standing on them are
+	// in this region or a touching one, so none of them runs now
+	for (int i = 0; i < 3; i++) {
+		const int altX = alternatives[i].first;
+		const int altY = alternatives[i].second;
+		if (!obstacleGrid.isBlocked(altX, altY)) {
+			cellWatchers[altX * WORLD_SIZE + altY] |= 1 << watchBit(agent->getX() - altX, agent->getY() - altY);
+		}
+	}
+	agent->sleep();
+	_InterlockedExchangeAdd(&regionAwake[agent->getRegionId()], -1);
+}
+
+void Ped::Model::releaseCell(int x, int y)
+{
+	unsigned char &watchers = cellWatchers[x * WORLD_SIZE + y];
+	if (watchers == 0) {
+		return;
+	}
+	for (int dy = -1; dy <= 1; dy++) {
+		for (int dx = -1; dx <= 1; dx++) {
+			if ((dx == 0 && dy == 0) || !(watchers & (1 << watchBit(dx, dy)))) {
+				continue;
+			}
+
+			// Whoever stands there now may not be the agent that started
+			// watching; waking an agent that isn't stuck only costs it a look
+			const int watcherX = x + dx;
+			const int watcherY = y + dy;
+			const long id = coordinates[watcherX][watcherY];
+			if (id != -1 && agents[id]->wake()) {
+				// Touching regions that don't touch each other may both
+				// wake agents of the watcher's region
+				_InterlockedIncrement(&regionAwake[agents[id]->getRegionId()]);
+			}
+		}
+	}
+	watchers = 0;
 }
 
 // Return the distance between two points in a 2d-plane.
@@ -615,48 +1522,161 @@ double getDistance(int x1, int y1, int x2, int y2) {
 	return diffX + diffY;
 }
 
-/// Returns the list of neighbors within dist of the point x/y. This
-/// can be the position of an agent, but it is not limited to this.
-/// \date    2012-01-29
-/// \return  The list of neighbors
-/// \param   x the x coordinate
-/// \param   y the y coordinate
-/// \param   dist the distance around x/y that will be searched for agents (search field is a square in the current implementation)
-//set<const Ped::Tagent*> Ped::Model::getNeighbors(int x, int y, int dist) const {
-set<const Ped::Tagent*> Ped::Model::getNeighborsRegions(Tagent *agent, int dist) const {
+void Ped::Model::queryNeighborsRegions(const Tagent *agent, int dist, NeighborBuffer &out) const {
+	out.clear();
+
+	// Only the agent's own region is searched; agents across the border
+	// are in the region's halo
+	const vector<Tagent *> &region = regions[agent->getRegionId()];
+	for (int i = 0; i < region.size(); i++) {
+		if (region[i] != agent && getDistance(region[i]->getX(), region[i]->getY(), agent->getX(), agent->getY()) <= dist) {
+			out.add(region[i]->getX(), region[i]->getY());
+		}
+	}
 
-	// Pick the correct region
-	set<Tagent *> region;
-	if (agent->getRegionId() == 1) {
-		region = region1;
+	const vector<HaloAgent> &halo = halos[agent->getRegionId()];
+	for (int i = 0; i < halo.size(); i++) {
+		if (getDistance(halo[i].x, halo[i].y, agent->getX(), agent->getY()) <= dist) {
+			out.add(halo[i].x, halo[i].y);
+		}
 	}
-	else if (agent->getRegionId() == 2) {
-		region = region2;
+}
+
+// Spreads the low 16 bits of v over the even bits of the result
+static unsigned int spreadBits(unsigned int v) {
+	v &= 0xFFFF;
+	v = (v | (v << 8)) & 0x00FF00FF;
+	v = (v | (v << 4)) & 0x0F0F0F0F;
+	v = (v | (v << 2)) & 0x33333333;
+	v = (v | (v << 1)) & 0x55555555;
+	return v;
+}
+
+// Position of cell (x, y) along the Morton (Z-order) curve
+static unsigned int mortonKey(int x, int y) {
+	x = std::min(std::max(x, 0), 0xFFFF);
+	y = std::min(std::max(y, 0), 0xFFFF);
+	return spreadBits(x) | (spreadBits(y) << 1);
+}
+
+double Ped::Model::agentLocality() const {
+	long long total = 0;
+	int pairs = 0;
+	const Ped::Tagent *previous = NULL;
+	for (int i = 0; i < agents.size(); i++) {
+		if (!agents[i]->isActive()) {
+			continue;
+		}
+		if (previous != NULL) {
+			total += std::max(abs(agents[i]->getX() - previous->getX()), abs(agents[i]->getY() - previous->getY()));
+			pairs++;
+		}
+		previous = agents[i];
 	}
-	else if (agent->getRegionId() == 3) {
-		region = region3;
+	return pairs == 0 ? 0.0 : (double)total / pairs;
+}
+
+void Ped::Model::reorderAgents() {
+	const int n = static_cast<int>(agents.size());
+
+	// Sort (key, slot) pairs; free slots go to the end
+	reorderOrder.clear();
+	for (int i = 0; i < n; i++) {
+		unsigned long long key = agents[i]->isActive() ? mortonKey(agents[i]->getX(), agents[i]->getY()) : 0xFFFFFFFFu;
+		reorderOrder.push_back((key << 32) | (unsigned int)i);
 	}
-	else if (agent->getRegionId() == 4) {
-		region = region4;
+	std::sort(reorderOrder.begin(), reorderOrder.end());
+
+	// Slot k receives the agent now in slot (reorderOrder[k] & 0xFFFFFFFF).
+	// Apply the permutation one cycle at a time, moving agents between the
+	// slots, so nothing is allocated and every pointer to a slot stays valid.
+	reorderVisited.assign(n, 0);
+	for (int k = 0; k < n; k++) {
+		if (reorderVisited[k]) {
+			continue;
+		}
+		Ped::Tagent first = std::move(*agents[k]);
+		int firstSource = slotSource[k];
+		int slot = k;
+		while (true) {
+			reorderVisited[slot] = 1;
+			int from = (int)(reorderOrder[slot] & 0xFFFFFFFF);
+			if (from == k) {
+				*agents[slot] = std::move(first);
+				slotSource[slot] = firstSource;
+				break;
+			}
+			*agents[slot] = std::move(*agents[from]);
+			slotSource[slot] = slotSource[from];
+			slot = from;
+		}
 	}
 
-	// Fetch all the neighbors within the specified distance.
-	set<const Ped::Tagent *> neighbors;
-	for (set<Tagent *>::iterator it = region.begin(); it != region.end(); ++it) {
-		if (getDistance((*it)->getX(), (*it)->getY(), agent->getX(), agent->getY()) <= dist) {
-			neighbors.insert(*it);
+	// Everything that refers to agents by slot or id follows them
+	for (int i = 0; i < WORLD_SIZE; i++) {
+		std::fill(coordinates[i].begin(), coordinates[i].end(), -1);
+	}
+	freeSlots.clear();
+	for (int i = n - 1; i >= 0; i--) {
+		agents[i]->setId(i);
+		syncAgentSIMD(i);
+		if (!agents[i]->isActive()) {
+			freeSlots.push_back(i);
+			continue;
+		}
+		const int agentX = agents[i]->getX();
+		const int agentY = agents[i]->getY();
+		if (agentX >= 0 && agentX < WORLD_SIZE && agentY >= 0 && agentY < WORLD_SIZE) {
+			coordinates[agentX][agentY] = i;
 		}
 	}
+	if (usesRegions()) {
+		assignRegions();
+	}
+	if (levelOfDetail) {
+		rebuildLevelOfDetail();
+	}
+	if (hybrid) {
+		rebuildMacroAgents();
+	}
 
-	return neighbors;
+	// The tree points at the slots, whose agents just changed
+	if (tree != NULL) {
+		tree->clear();
+		for (int i = 0; i < agents.size(); i++) {
+			if (agents[i]->isActive()) {
+				placeAgent(agents[i]);
+			}
+		}
+	}
 }
 
 void Ped::Model::cleanup() {
-	// Nothing to do here right now. 
+	if (tree != NULL) {
+		tree->update();
+	}
+
+	ticksSinceReorder++;
+	if (ticksSinceReorder % REORDER_CHECK != 0) {
+		return;
+	}
+	if (ticksSinceReorder >= REORDER_INTERVAL || agentLocality() > 2 * reorderBaseline + 1) {
+		reorderAgents();
+		ticksSinceReorder = 0;
+		reorderBaseline = agentLocality();
+	}
 }
 
 Ped::Model::~Model()
 {
-	std::for_each(agents.begin(), agents.end(), [](Ped::Tagent *agent) {delete agent; });
-	std::for_each(destinations.begin(), destinations.end(), [](Ped::Twaypoint *destination) {delete destination; });
+	// Agents and waypoints are freed with their pools
+	std::for_each(flowFields.begin(), flowFields.end(), [](Ped::Tflowfield *field) {delete field; });
+	std::for_each(obstacles.begin(), obstacles.end(), [](Ped::Tobstacle *obstacle) {delete obstacle; });
+	std::for_each(sources.begin(), sources.end(), [](Ped::Tsource *source) {delete source; });
+	std::for_each(sinks.begin(), sinks.end(), [](Ped::Tsink *sink) {delete sink; });
+	delete scheduler;
+	delete tree;
+	if (usesDevice) {
+		cuda_release();
+	}
 }
\ No newline at end of file
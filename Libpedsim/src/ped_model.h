@@ -14,9 +14,26 @@
 #include <vector>
 #include <map>
 #include <set>
+#include <atomic>
+#include <chrono>
 #include <smmintrin.h>
 
 #include "ped_agent.h"
+#include "ped_export.h"
+#include "ped_blur.h"
+#include "ped_flowfield.h"
+#include "ped_metrics.h"
+#include "ped_obstacle.h"
+#include "ped_perfcounters.h"
+#include "ped_pipeline.h"
+#include "ped_source.h"
+#include "ped_pool.h"
+#include "ped_scheduler.h"
+#include "ped_tree.h"
+#include "ped_waypoint.h"
+
+// Side length of the square world agents walk in, in cells
+#define WORLD_SIZE 300
 
 namespace Ped {
 	class Tagent;
@@ -24,33 +41,123 @@ namespace Ped {
 	// The implementation modes for Assignment 1 + 2:
 	// chooses which implementation to use for tick()
 	enum IMPLEMENTATION {
-		CUDA, VECTOR, OMP, PTHREAD, SEQ, VECTOROMP, REGION, SEQCOLLISION, SEQCOLLISIONOMP, DYNAMICREGION, CPU_GPU, HEATMAP_SEQ
+		CUDA, VECTOR, OMP, PTHREAD, SEQ, VECTOROMP, REGION, SEQCOLLISION, SEQCOLLISIONOMP, DYNAMICREGION, CPU_GPU, HEATMAP_SEQ, INTSTEP, FLOWFIELD
+	};
+
+	// Copy of an agent from a neighboring region, see Model::halos
+	struct HaloAgent {
+		int x;
+		int y;
+		long id;
+	};
+
+	// Positions of the agents found by a neighbor query. The caller owns
+	// the buffer, typically on its stack, so a query never allocates.
+	struct NeighborBuffer {
+		// Cells within distance 4 of an agent, the farthest any backend
+		// looks, plus room for stale halo copies
+		enum { CAPACITY = 64 };
+
+		int x[CAPACITY];
+		int y[CAPACITY];
+		int count;
+
+		// Set if there were more neighbors than fit
+		bool overflowed;
+
+		NeighborBuffer() : count(0), overflowed(false) {}
+
+		void clear() { count = 0; overflowed = false; }
+
+		void add(int neighborX, int neighborY) {
+			if (count == CAPACITY) {
+				overflowed = true;
+				return;
+			}
+			x[count] = neighborX;
+			y[count] = neighborY;
+			count++;
+		}
+
+		// True if a neighbor stands at (cellX, cellY). After an overflow
+		// the buffer can't tell, so every cell counts as taken.
+		bool contains(int cellX, int cellY) const {
+			if (overflowed) {
+				return true;
+			}
+			for (int i = 0; i < count; i++) {
+				if (x[i] == cellX && y[i] == cellY) {
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
+	// A rectangle of the blurred heatmap, in heatmap pixels
+	struct HeatmapRect {
+		int x;
+		int y;
+		int width;
+		int height;
 	};
 
 	class Model
 	{
 	public:
 
+		// Creates an agent or a waypoint owned by this model. All of them
+		// are freed together when the model is destroyed. The agents and
+		// waypoints passed to setup must come from here.
+		Tagent *createAgent(int x, int y) { return agentPool.create(x, y); };
+		Twaypoint *createWaypoint(double x, double y, double r) { return waypointPool.create(x, y, r); };
+
+		// Makes room for n more agents in one block, so they lie together
+		void reserveAgents(size_t n) { agentPool.reserve(n); };
+
 		// Sets everything up
 		void setup(std::vector<Tagent*> agentsInScenario, std::vector<Twaypoint*> destinationsInScenario, IMPLEMENTATION implementation);
+		void setup(std::vector<Tagent*> agentsInScenario, std::vector<Twaypoint*> destinationsInScenario, std::vector<Tobstacle*> obstaclesInScenario, IMPLEMENTATION implementation);
+
+		// Also sets up entrances and exits. One free agent slot is made
+		// for every agent the sources may have alive at once, so
+		// spawning never allocates.
+		void setup(std::vector<Tagent*> agentsInScenario, std::vector<Twaypoint*> destinationsInScenario, std::vector<Tobstacle*> obstaclesInScenario,
+			std::vector<Tsource*> sourcesInScenario, std::vector<Tsink*> sinksInScenario, IMPLEMENTATION implementation);
 
 		// Coordinates a time step in the scenario: move all agents by one step (if applicable).
 		void tick();
-		void regionTask(set<Tagent*>);
-		void region2Task();
-		void region3Task();
-		void region4Task();
+
+		// Moves the agents of one region (see regions)
+		void regionTask(int region);
+
+		// Moves all agents with collision detection, one task per region,
+		// on the work-stealing scheduler. Regions that touch never run at
+		// the same time, see setupRegions().
 		void collision_detection_regions();
 
-		// Returns the agents of this scenario
-		const std::vector<Tagent*> getAgents() const { return agents; };
+		// Returns the agents of this scenario, including the free slots
+		// (see Tagent::isActive)
+		const std::vector<Tagent*> &getAgents() const { return agents; };
+
+		// Returns the obstacles of this scenario, and the cells they block
+		const std::vector<Tobstacle*> &getObstacles() const { return obstacles; };
+		const TobstacleGrid &getObstacleGrid() const { return obstacleGrid; };
 
-		// Adds an agent to the tree structure
+		// Adds an agent to the tree structure. Only the SEQCOLLISION
+		// implementations keep a tree; for the others this does nothing.
 		void placeAgent(const Ped::Tagent *a);
 
-		set<const Ped::Tagent*> getNeighborsRegions(Tagent * agent, int dist) const;
+		// Writes the positions of the other agents within dist of agent
+		// into out: those of its own region and the copies in the
+		// region's halo. Requires dist < HALO_WIDTH.
+		void queryNeighborsRegions(const Tagent *agent, int dist, NeighborBuffer &out) const;
 
-		// Cleans up the tree and restructures it. Worth calling every now and then.
+		// Cleans up the tree and restructures it: refiles the agents that
+		// moved, splitting the leaves that got crowded and merging those
+		// that emptied. Called at the end of every tick; every REORDER_INTERVAL ticks, or
+		// sooner if agentLocality() has degraded, it sorts the agents along
+		// a Morton curve so that agents close in the world are close in memory.
 		void cleanup();
 		~Model();
 
@@ -58,6 +165,70 @@ namespace Ped {
 		int const * const * getHeatmap() const { return blurred_heatmap; };
 		int getHeatmapSize() const;
 
+		// Returns the areas of the blurred heatmap that changed in the last tick
+		const std::vector<HeatmapRect> &getHeatmapDirtyRects() const { return heatmapDirtyRects; };
+
+		// Number of threads the parallel backends use. 0, the default,
+		// leaves it to each backend: 4 OpenMP threads, one scheduler
+		// thread per hardware thread, and a single PTHREAD slice.
+		void setNumThreads(int threads);
+		int getNumThreads() const { return numThreads; };
+
+		// Selects the blur of the heatmap: a 3x3, 5x5 (the default) or
+		// 7x7 kernel. Returns false for any other size. The whole
+		// heatmap is blurred again on the next tick.
+		bool setHeatmapBlur(int kernelSize);
+
+		// Stages of a tick the pipelines can time
+		enum STAGE { MOVEMENT_STAGE, HEATMAP_STAGE, STAGE_COUNT };
+
+		// Makes the pipelines record how long each stage of a tick took.
+		// Backends with a tick of their own record nothing.
+		void setStageTiming(bool enabled);
+
+		// Seconds the stage took in the last tick, or -1 if not recorded
+		double getStageSeconds(STAGE stage) const { return stageSeconds[stage]; };
+
+		// Makes the timed pipelines also read the hardware counters
+		// around each stage, on every thread that works on it. Has no
+		// effect without setStageTiming.
+		void setStageCounting(bool enabled);
+
+		// Events counted during the stage in the last tick, summed over
+		// the threads that worked on it
+		unsigned long long getStageCount(STAGE stage, Tperfcounters::COUNTER counter) const { return stageCounts[stage][counter]; };
+
+		// Reports every tick's latencies, the collision retries and
+		// failures and the agent count to metrics, which must outlive
+		// the model or be replaced by NULL. Turns on stage timing.
+		void setMetrics(Tmetrics *metrics);
+
+		// Level of detail for SEQCOLLISION and SEQCOLLISIONOMP: agents
+		// alone in their part of the world are walked LOD_INTERVAL steps
+		// at once, every LOD_INTERVAL ticks, without collision checks,
+		// while agents near others are moved every tick. Agents switch
+		// between the two at the start of a tick. Other backends ignore it.
+		void setLevelOfDetail(bool enabled);
+
+		// Agents moved every tick by the level of detail
+		int getDenseAgentCount() const { return static_cast<int>(lodDense.size()); };
+
+		// Hybrid model for HEATMAP_SEQ: blocks of the world whose heat
+		// shows a jam are simulated as a crowd density that flows from
+		// block to block, instead of agent by agent. Agents walking into
+		// such a block join the density; agents flowing out of it are
+		// placed back onto free cells at its edge. Carried agents stay
+		// in getAgents(), standing on cells of their block. Other
+		// backends ignore it.
+		void setHybrid(bool enabled);
+
+		// Agents carried by the density blocks of the hybrid model
+		int getMacroAgentCount() const;
+
+		// Publishes the agents and the heatmap to exporter after every
+		// tick. The exporter must outlive the model or be replaced by NULL.
+		void setExport(Texport *exporter) { this->exporter = exporter; };
+
 		Ped::TagentSIMD agentsSIMD;
 		std::vector<__m128i> x;
 		std::vector<__m128i> y;
@@ -68,16 +239,6 @@ namespace Ped {
 		void tick_SIMD();
 		void tick_SIMDOMP();
 
-		set<Tagent*>region1 = set<Tagent*>();
-		set<Tagent*>region2 = set<Tagent*>();
-		set<Tagent*>region3 = set<Tagent*>();
-		set<Tagent*>region4 = set<Tagent*>();
-
-
-
-		vector<set<Tagent *>> regions = vector<set<Tagent *>>();
-
-
 		vector<vector<long>> coordinates;
 
 	private:
@@ -87,19 +248,342 @@ namespace Ped {
 		// agents (Assignment 1)
 		IMPLEMENTATION implementation;
 
+		// Integer-only desired positions, see Ped::unitStep
+		void tick_INTSTEP();
+
+		// Desired positions looked up in the waypoints' flow fields
+		void tick_FLOWFIELD();
+
+		// A tick specialized on the policies in ped_pipeline.h
+		template<typename Movement, typename CollisionPolicy, typename HeatmapPolicy, typename InstrumentationPolicy>
+		void tickPipeline();
+
+		// Moves one agent of a pipeline that walks the agents one by one
+		template<typename CollisionPolicy>
+		void stepAgent(Tagent *agent);
+
+		// The pipeline setup() picked for the implementation, or NULL if
+		// the implementation has a tick of its own
+		typedef void (Model::*TickFunction)();
+		TickFunction tickFunction = NULL;
+		static TickFunction pipelineFor(IMPLEMENTATION implementation, bool timed);
+		template<typename Movement, typename CollisionPolicy, typename HeatmapPolicy>
+		static TickFunction pipeline(bool timed);
+
+		// See setStageTiming
+		bool stageTiming = false;
+		double stageSeconds[STAGE_COUNT] = { -1, -1 };
+
+		// See setStageCounting. countingMovement tells the region tasks
+		// to count while a counted pipeline moves the agents.
+		bool stageCounting = false;
+		bool countingMovement = false;
+		std::atomic<unsigned long long> stageCounts[STAGE_COUNT][Tperfcounters::COUNTER_COUNT];
+		void clearStageCounts(STAGE stage);
+
+		// Adds the events counted on the calling thread since before was read
+		void addStageCounts(STAGE stage, const unsigned long long before[Tperfcounters::COUNTER_COUNT]);
+
+		// See setMetrics; NULL if not reporting
+		Tmetrics *metrics = NULL;
+
+		// See setExport; NULL if not publishing
+		Texport *exporter = NULL;
+		void reportMetrics(std::chrono::steady_clock::time_point tickStart);
+
+// Side length of the blocks the level of detail counts agents in
+#define LOD_BLOCK 6
+// Ticks between two moves of an isolated agent. An agent is isolated
+// when no other agent is in its block or the ones around it, so
+// nobody is within LOD_BLOCK cells; until it is looked at again, it
+// and any other agent close in by at most 2 * LOD_INTERVAL cells,
+// which must stay below LOD_BLOCK + 1.
+#define LOD_INTERVAL 3
+
+		// See setLevelOfDetail
+		bool levelOfDetail = false;
+
+		// Number of active agents in each block, row by row
+		std::vector<int> lodOccupancy;
+		int lodBlocksPerSide;
+
+		// The agents moved every tick, and the isolated agents by the
+		// tick of the level of detail cycle on which they are moved
+		std::vector<Tagent*> lodDense;
+		std::vector<std::vector<Tagent*> > lodSparse;
+		std::vector<Tagent*> lodScratch;
+		int lodTick = 0;
+
+		// Block containing cell (x, y); cells outside the world belong
+		// to the nearest block
+		int lodBlockOf(int x, int y) const;
+
+		// True if the agent is the only one in its block and the blocks
+		// around it
+		bool lodIsolated(const Tagent *agent) const;
+
+		// Counts the agent in the block it now stands in
+		void lodCount(Tagent *agent);
+
+		// Refills the lists and the counts from the agents, keeping the
+		// list each agent is in
+		void rebuildLevelOfDetail();
+
+		// Moves the agents between the lists at the start of a tick
+		void classifyLevelOfDetail();
+
+		// Moves the dense agents one step and this tick's isolated
+		// agents LOD_INTERVAL steps
+		template<typename Movement>
+		void moveLevelOfDetail(bool counting);
+
+		// Walks an isolated agent LOD_INTERVAL steps
+		void advanceIsolated(Tagent *agent);
+
+// Side length of the blocks of the hybrid model, in cells. Divides
+// REGION_SIZE, so every block lies in a single region.
+#define MACRO_BLOCK 8
+// Heat of a cell some agent wants every tick: the heatmap settles at
+// 40 / (1 - 0.8) there
+#define MACRO_HEAT 200
+// A block turns into a density once its mean heat reaches MACRO_ENTER
+// of MACRO_HEAT, and back into agents once it drops below MACRO_LEAVE
+#define MACRO_ENTER 0.8
+#define MACRO_LEAVE 0.5
+// Most agents a block sends, or takes in, per tick
+#define MACRO_FLOW 8
+
+		// See setHybrid
+		bool hybrid = false;
+		int macroBlocksPerSide;
+
+		// For each block, row by row: whether it is a density, its cells
+		// that are not walls, and the agents it carries
+		std::vector<char> macroDense;
+		std::vector<int> macroFreeCells;
+		std::vector<std::vector<Tagent*> > macroAgents;
+
+		// Agents each block may still send, as spawnCredit, and what it
+		// may take in and has taken in this tick
+		std::vector<double> macroCredit;
+		std::vector<double> macroReceive;
+		std::vector<int> macroReceived;
+
+		// Agents that flowed into another density block this tick
+		std::vector<std::pair<Tagent*, int> > macroArrivals;
+
+		// Block containing cell (x, y), or -1 outside the world
+		int macroBlockOf(int x, int y) const;
+
+		// Turns blocks into densities and back, takes in the agents that
+		// walked into density blocks, and lets the densities flow.
+		// Called at the start of each tick, before the agents move.
+		void updateHybrid();
+
+		// Mean heat of the block's free cells, in units of MACRO_HEAT
+		double macroDensity(int block) const;
+
+		// Hands the agents of a density block back to the regions
+		void releaseMacroBlock(int block);
+		void absorbMacroBlock(int block);
+
+		// Moves a carried agent to the first of its alternatives that is
+		// free, within its block or, budgets allowing, into another one.
+		// Returns true if it left the block.
+		bool moveMacroAgent(Tagent *agent, int block);
+		bool flowMacroAgent(Tagent *agent, int target, int x, int y);
+
+		// Finds the free cell of the block nearest to (x, y), at most
+		// maxDistance away
+		bool findMacroCell(int block, int x, int y, int maxDistance, int &cellX, int &cellY) const;
+
+		// Moves an agent to a free cell, keeping coordinates up to date
+		void placeOnCell(Tagent *agent, int x, int y);
+
+		// Takes a despawned agent off its block's list
+		void removeFromMacro(Tagent *agent);
+
+		// Refills the blocks' lists from the agents, see reorderAgents
+		void rebuildMacroAgents();
+
+		// Storage of all agents and waypoints of this model
+		Tpool<Tagent> agentPool;
+		Tpool<Twaypoint> waypointPool;
+
 		// The agents in this scenario
 		std::vector<Tagent*> agents;
 
 		// The waypoints in this scenario
 		std::vector<Twaypoint*> destinations;
 
+		// The walls in this scenario, rasterized into obstacleGrid.
+		// Agents never move into a blocked cell.
+		std::vector<Tobstacle*> obstacles;
+		TobstacleGrid obstacleGrid;
+
+		// Flow field towards each waypoint, indexed by the waypoint's id
+		// minus firstWaypointId. Built the first time an agent heads
+		// there and kept for the rest of the simulation.
+		std::vector<Tflowfield*> flowFields;
+
+		// Set by the agents of a tick, from several threads, for the
+		// waypoints whose field is still missing
+		std::vector<std::atomic<unsigned char> > flowFieldRequested;
+		int firstWaypointId;
+
+		// Builds, in parallel, the fields requested since the last call
+		void buildRequestedFlowFields();
+
+		// Entrances and exits of this scenario
+		std::vector<Tsource*> sources;
+		std::vector<Tsink*> sinks;
+
+		// Indices of the inactive agents, reused by the next spawns
+		std::vector<int> freeSlots;
+
+		// Source each agent came from (-1 if from the scenario), and how
+		// many agents of each source are currently alive
+		std::vector<int> slotSource;
+		std::vector<int> sourceAlive;
+
+		// Fractional agents each source still owes
+		std::vector<double> spawnCredit;
+
+		// State of the random generator that picks spawn cells
+		unsigned int spawnRandom;
+
+		// Removes agents that reached a sink and spawns the sources' new agents
+		void updateSpawning();
+		bool spawnAgent(int source);
+		void despawnAgent(int slot);
+
+		// Copies the position of agents[i] into its SIMD lane
+		void syncAgentSIMD(int i);
+
+// Side length of the square regions, in cells. Larger than the
+// distance agents look for neighbors, so an agent only ever looks
+// into its own region and the ones next to it.
+#define REGION_SIZE 16
+
+		// The agents in each region, row by row, regionsPerSide regions
+		// per row. An agent's region id is its index in here, and its
+		// region index its position in the region's list.
+		vector<vector<Tagent *>> regions = vector<vector<Tagent *>>();
+		int regionsPerSide;
+
+// How far a halo reaches into the neighboring regions: the neighbor
+// search distance (4) plus the step a neighbor may take before its
+// region's task runs
+#define HALO_WIDTH 5
+
+		// For each region, copies of the agents of the neighboring
+		// regions that are within HALO_WIDTH of its border, taken at the
+		// start of the tick. With them a neighbor search only reads its
+		// own region's data.
+		vector<vector<HaloAgent>> halos;
+
+		// Number of agents in each region that are not asleep. A region
+		// without any has nothing to move and its task returns at once.
+		vector<long> regionAwake;
+
+		// For each cell, at x * WORLD_SIZE + y, the sleeping agents next to
+		// it that wait for it to be freed: bit watchBit(dx, dy) is set for
+		// the agent at (x + dx, y + dy). See moveRegions.
+		vector<unsigned char> cellWatchers;
+
+		// Rebuilds the regions from the agents' current positions
+		void assignRegions();
+
+		// Adds the agent to, or removes it from, the list of its region
+		void addToRegion(Tagent *agent, int region);
+		void removeFromRegion(Tagent *agent);
+
+		// For each region, its agents that stepped into another region
+		// during its task. Each region task only writes its own list, so
+		// no locking is needed; migrateAgents() then moves just these
+		// agents instead of rebuilding every region.
+		std::vector<std::vector<Tagent*> > emigrants;
+		void migrateAgents();
+
+		// Copies the agents near every region border into the halos of the
+		// regions across that border
+		void refreshHalos();
+
+		// Region containing cell (x, y); cells outside the world belong
+		// to the nearest region
+		int regionOf(int x, int y) const;
+
+		// Builds the regions and the task graph that orders them: regions
+		// are colored 0-3 by the parity of their row and column, and each
+		// region waits for its neighbors of a lower color. Touching
+		// regions never share a color, so they never run concurrently,
+		// while a region may start as soon as its own neighbors are done.
+		void setupRegions();
+
+		// True for the backends that move agents region by region. The
+		// others leave the regions as setup() built them.
+		bool usesRegions() const;
+		std::vector<int> regionDependencies;
+		std::vector<int> regionSuccessorStart;
+		std::vector<int> regionSuccessors;
+
+		// Runs the region tasks and the PTHREAD backend; created the
+		// first time it is needed
+		Tscheduler *scheduler = NULL;
+		Tscheduler &taskScheduler();
+
+		// See setNumThreads
+		int numThreads = 0;
+		int ompThreads() const { return numThreads > 0 ? numThreads : 4; };
+
+		// Task graph of the PTHREAD backend: one independent task per slice
+		std::vector<int> pthreadGraph;
+
+// Ticks between two reorderings of the agents, at most
+#define REORDER_INTERVAL 256
+// Ticks between two checks of agentLocality()
+#define REORDER_CHECK 16
+
+		int ticksSinceReorder;
+
+		// agentLocality() right after the last reordering
+		double reorderBaseline;
+
+		// Scratch space for reorderAgents(), allocated at setup
+		std::vector<unsigned long long> reorderOrder;
+		std::vector<char> reorderVisited;
+
+		// Mean distance in cells between agents that are next to each
+		// other in memory. Grows as agents move away from their neighbors.
+		double agentLocality() const;
+
+		// Sorts the agents along a Morton curve, in place
+		void reorderAgents();
+
+		// The three cells that would bring the agent closer to its desired
+		// position, starting with the desired position itself
+		static void prioritizedAlternatives(const Tagent *agent, std::pair<int, int> alternatives[3]);
+
 		// Moves an agent towards its next position
 		void move(Ped::Tagent *agent);
 
-		set<const Ped::Tagent*> getNeighbors(int x, int y, int dist) const;
+		// Writes the positions of the agents within dist of (x, y),
+		// except the agent standing there, into out
+		void queryNeighbors(int x, int y, int dist, NeighborBuffer &out) const;
+
+		// The active agents, searched by queryNeighbors; see placeAgent
+		Ttree *tree = NULL;
 
 		void moveRegions(Ped::Tagent * agent);
 
+		// Puts an agent that could not move to sleep if only a freed cell
+		// can change that: every one of its alternatives is a wall or
+		// taken in coordinates. It watches the taken ones.
+		void sleepIfStuck(Ped::Tagent *agent, const std::pair<int, int> alternatives[3]);
+
+		// Wakes the agents watching the cell, which was just freed
+		void releaseCell(int x, int y);
+
 		void setAgentPosition(Tagent * agent);
 
 		// TODO: Add a datastructure to store the structure of array of agents
@@ -126,11 +610,44 @@ namespace Ped {
 
 		// The scaled heatmap that fits to the view
 		int ** scaled_heatmap;
-		int ** scaled_heatmap1;
 
 		// The final heatmap: blurred and scaled to fit the view
 		int ** blurred_heatmap;
 
+// Side length of the heatmap tiles that are checked for changes
+#define HEATMAP_TILE 32
+// A tile is redrawn once one of its cells changed by more than this
+#define HEATMAP_THRESHOLD 2
+
+		// The heatmap values the scaled and blurred heatmaps currently show
+		int ** published_heatmap;
+
+		// Areas of blurred_heatmap that were redrawn in the last tick
+		std::vector<HeatmapRect> heatmapDirtyRects;
+
+		// Desired positions handed to the CUDA heatmap every tick
+		std::vector<int> heatmapDesiredX;
+		std::vector<int> heatmapDesiredY;
+
+		// Radius of the blur kernel, see ped_blur.h
+		int blurRadius = 2;
+#define BLUR_MAX_RADIUS 3
+
+		// Set when every tile has to be blurred again, whether it changed or not
+		bool heatmapRedrawAll = false;
+
+		// Result of the horizontal blur pass over one rectangle
+		std::vector<int> blurScratch;
+
+		bool heatmapTileChanged(int tileX, int tileY) const;
+		void blurHeatmapRect(const HeatmapRect &rect);
+		template<int Radius>
+		void blurHeatmapRectWith(const HeatmapRect &rect);
+
+		// True once setupHeatmapSeq counted this model in to the CUDA
+		// device buffers, see cuda_setupHeatmap
+		bool usesDevice = false;
+
 		void setupHeatmapSeq();
 		void updateHeatmapCUDA(Model *model);
 		void updateHeatmapSeq();
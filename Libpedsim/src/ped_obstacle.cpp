@@ -0,0 +1,93 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Implements obstacles and their rasterization into the blocked-cell grid.
+//
+#include "ped_obstacle.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+Ped::Tobstacle::Tobstacle(int x, int y, int width, int height) : shape(RECT)
+{
+	points.push_back(std::make_pair(x, y));
+	points.push_back(std::make_pair(x + width, y + height));
+}
+
+Ped::Tobstacle::Tobstacle(const std::vector<std::pair<int, int> > &points) : shape(POLYLINE), points(points)
+{
+}
+
+Ped::TobstacleGrid::TobstacleGrid() : width(0), height(0), wordsPerRow(0)
+{
+}
+
+Ped::TobstacleGrid::TobstacleGrid(int width, int height) : width(width), height(height),
+	wordsPerRow((width + 63) / 64), bits(wordsPerRow * height, 0)
+{
+}
+
+void Ped::TobstacleGrid::block(int x, int y)
+{
+	if ((unsigned)x < (unsigned)width && (unsigned)y < (unsigned)height) {
+		bits[y * wordsPerRow + (x >> 6)] |= (uint64_t)1 << (x & 63);
+	}
+}
+
+void Ped::TobstacleGrid::add(const Tobstacle &obstacle)
+{
+	const std::vector<std::pair<int, int> > &points = obstacle.getPoints();
+	if (obstacle.getShape() == Tobstacle::RECT) {
+		const int left = std::max(points[0].first, 0);
+		const int top = std::max(points[0].second, 0);
+		const int right = std::min(points[1].first, width);
+		const int bottom = std::min(points[1].second, height);
+		for (int y = top; y < bottom; y++) {
+			for (int x = left; x < right; x++) {
+				block(x, y);
+			}
+		}
+	}
+	else {
+		for (size_t i = 0; i < points.size(); i++) {
+			// A single point still blocks its own cell
+			const std::pair<int, int> &next = points[i + 1 < points.size() ? i + 1 : i];
+			addLine(points[i].first, points[i].second, next.first, next.second);
+		}
+	}
+}
+
+void Ped::TobstacleGrid::addLine(int x0, int y0, int x1, int y1)
+{
+	// Bresenham, except that a diagonal step also blocks the cell it
+	// cuts across. Agents may move diagonally, and would otherwise
+	// slip through the gap between two diagonally adjacent cells.
+	const int dx = std::abs(x1 - x0);
+	const int dy = std::abs(y1 - y0);
+	const int sx = x0 < x1 ? 1 : -1;
+	const int sy = y0 < y1 ? 1 : -1;
+	int error = dx - dy;
+
+	block(x0, y0);
+	while (x0 != x1 || y0 != y1) {
+		const int error2 = 2 * error;
+		if (error2 > -dy) {
+			error -= dy;
+			x0 += sx;
+			block(x0, y0);
+		}
+		if (error2 < dx) {
+			error += dx;
+			y0 += sy;
+			block(x0, y0);
+		}
+	}
+}
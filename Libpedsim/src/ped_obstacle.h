@@ -0,0 +1,76 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Tobstacle is a static wall in a scenario: either a filled
+// rectangle or a polyline. Agents never enter a cell covered by
+// an obstacle.
+//
+// TobstacleGrid holds all obstacles rasterized into one bit per
+// cell, so checking a candidate cell is a single bit test no
+// matter how many obstacles the scenario has.
+//
+#ifndef _ped_obstacle_h_
+#define _ped_obstacle_h_ 1
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+namespace Ped {
+	class Tobstacle {
+	public:
+		enum Shape { RECT, POLYLINE };
+
+		// A filled rectangle covering the cells [x, x + width) x [y, y + height)
+		Tobstacle(int x, int y, int width, int height);
+
+		// A wall through the given cells, one segment per consecutive pair
+		Tobstacle(const std::vector<std::pair<int, int> > &points);
+
+		Shape getShape() const { return shape; };
+
+		// For a rectangle its top left corner and the cell just past its
+		// bottom right corner; for a polyline its points
+		const std::vector<std::pair<int, int> > &getPoints() const { return points; };
+
+	private:
+		Shape shape;
+		std::vector<std::pair<int, int> > points;
+	};
+
+	class TobstacleGrid {
+	public:
+		TobstacleGrid();
+		TobstacleGrid(int width, int height);
+
+		// Marks every cell covered by the obstacle as blocked
+		void add(const Tobstacle &obstacle);
+
+		// True if (x, y) is covered by an obstacle. Cells outside
+		// the grid are never blocked.
+		bool isBlocked(int x, int y) const {
+			if ((unsigned)x >= (unsigned)width || (unsigned)y >= (unsigned)height) {
+				return false;
+			}
+			return (bits[y * wordsPerRow + (x >> 6)] >> (x & 63)) & 1;
+		}
+
+		int getWidth() const { return width; };
+		int getHeight() const { return height; };
+
+	private:
+		void block(int x, int y);
+
+		// Blocks the cells on the segment from (x0, y0) to (x1, y1)
+		void addLine(int x0, int y0, int x1, int y1);
+
+		int width;
+		int height;
+
+		// One row of the grid takes wordsPerRow 64-bit words
+		int wordsPerRow;
+		std::vector<uint64_t> bits;
+	};
+}
+
+#endif
@@ -0,0 +1,139 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+#include "ped_perfcounters.h"
+#include <atomic>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cstring>
+#include <cerrno>
+#include <iostream>
+#endif
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+// Bit i is set once counter i has been opened on some thread
+static std::atomic<int> openedCounters(0);
+
+#ifdef __linux__
+
+static const unsigned long long EVENTS[Ped::Tperfcounters::COUNTER_COUNT] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+
+static std::atomic<bool> reportedFailure(false);
+
+// The counters of one thread, opened as a single group so that one
+// read() returns all of them, counted over the same interval
+struct ThreadCounters {
+	ThreadCounters() : leader(-1), opened(false) {
+		for (int i = 0; i < Ped::Tperfcounters::COUNTER_COUNT; i++) {
+			fds[i] = -1;
+			slot[i] = -1;
+		}
+	}
+
+	~ThreadCounters() {
+		for (int i = 0; i < Ped::Tperfcounters::COUNTER_COUNT; i++) {
+			if (fds[i] >= 0) {
+				close(fds[i]);
+			}
+		}
+	}
+
+	void open() {
+		opened = true;
+		int members = 0;
+		for (int i = 0; i < Ped::Tperfcounters::COUNTER_COUNT; i++) {
+			perf_event_attr attr;
+			memset(&attr, 0, sizeof(attr));
+			attr.size = sizeof(attr);
+			attr.type = PERF_TYPE_HARDWARE;
+			attr.config = EVENTS[i];
+			attr.read_format = PERF_FORMAT_GROUP;
+			attr.exclude_kernel = 1;
+			attr.exclude_hv = 1;
+			attr.disabled = leader < 0;
+
+			fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+			if (fds[i] < 0) {
+				if (!reportedFailure.exchange(true)) {
+					std::cerr << "Hardware counter " << Ped::Tperfcounters::name((Ped::Tperfcounters::COUNTER)i)
+						<< " unavailable: " << strerror(errno) << std::endl;
+				}
+				continue;
+			}
+			if (leader < 0) {
+				leader = fds[i];
+			}
+			slot[i] = members++;
+			openedCounters |= 1 << i;
+		}
+		if (leader >= 0) {
+			ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+	}
+
+	void read(unsigned long long values[Ped::Tperfcounters::COUNTER_COUNT]) {
+		if (!opened) {
+			open();
+		}
+
+		// The group's layout: the number of members, then their values
+		unsigned long long group[1 + Ped::Tperfcounters::COUNTER_COUNT] = { 0 };
+		if (leader < 0 || ::read(leader, group, sizeof(group)) <= 0) {
+			group[0] = 0;
+		}
+		for (int i = 0; i < Ped::Tperfcounters::COUNTER_COUNT; i++) {
+			values[i] = (slot[i] >= 0 && slot[i] < (long long)group[0]) ? group[1 + slot[i]] : 0;
+		}
+	}
+
+	int fds[Ped::Tperfcounters::COUNTER_COUNT];
+
+	// Position of each counter's value in the group, -1 if not opened
+	int slot[Ped::Tperfcounters::COUNTER_COUNT];
+	int leader;
+	bool opened;
+};
+
+void Ped::Tperfcounters::read(unsigned long long values[COUNTER_COUNT])
+{
+	static thread_local ThreadCounters counters;
+	counters.read(values);
+}
+
+#else
+
+void Ped::Tperfcounters::read(unsigned long long values[COUNTER_COUNT])
+{
+	for (int i = 0; i < COUNTER_COUNT; i++) {
+		values[i] = 0;
+	}
+}
+
+#endif
+
+bool Ped::Tperfcounters::available(COUNTER counter)
+{
+	return (openedCounters & (1 << counter)) != 0;
+}
+
+const char *Ped::Tperfcounters::name(COUNTER counter)
+{
+	static const char *names[] = { "cycles", "instructions", "LLC misses", "branch misses" };
+	return names[counter];
+}
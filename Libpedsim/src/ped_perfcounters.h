@@ -0,0 +1,35 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Tperfcounters reads the processor's hardware event counters for
+// the calling thread: cycles, instructions, last-level cache misses
+// and branch misses. On Linux they are opened with perf_event_open
+// the first time a thread reads them, and count only that thread's
+// user-space work.
+//
+// The counters are often unavailable: on other systems, in
+// containers, under a strict perf_event_paranoid, or in virtual
+// machines without a virtual PMU. Counters that cannot be opened
+// read as 0 and available() reports them as missing, so callers
+// never have to handle an error.
+//
+#ifndef _ped_perfcounters_h_
+#define _ped_perfcounters_h_ 1
+
+namespace Ped {
+	class Tperfcounters {
+	public:
+		enum COUNTER { CYCLES, INSTRUCTIONS, LLC_MISSES, BRANCH_MISSES, COUNTER_COUNT };
+
+		// Reads the calling thread's counters
+		static void read(unsigned long long values[COUNTER_COUNT]);
+
+		// True if the counter could be opened. Only meaningful after a
+		// first read().
+		static bool available(COUNTER counter);
+
+		static const char *name(COUNTER counter);
+	};
+}
+
+#endif
@@ -0,0 +1,36 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Policies that Model::tickPipeline is specialized on. Each backend
+// that moves agents one by one is one combination of them, chosen
+// once in setup(); a stage its policies switch off is compiled out of
+// its pipeline, so the agent loop is left with no per-agent branch on
+// the implementation.
+//
+#ifndef _ped_pipeline_h_
+#define _ped_pipeline_h_ 1
+
+namespace Ped {
+	// Movement kernels: how the agents are walked. Sequentially, split
+	// over OpenMP threads, or region by region on the task scheduler,
+	// which always resolves collisions.
+	struct SequentialMovement { enum { parallel = 0, regions = 0 }; };
+	struct ParallelMovement { enum { parallel = 1, regions = 0 }; };
+	struct RegionMovement { enum { parallel = 1, regions = 1 }; };
+
+	// Whether an agent checks its neighbors before stepping, or steps
+	// straight onto its desired position
+	struct NoCollision { enum { enabled = 0 }; };
+	struct Collision { enum { enabled = 1 }; };
+
+	// Whether the heatmap is updated on the CPU after the agents moved
+	struct NoHeatmap { enum { enabled = 0 }; };
+	struct SequentialHeatmap { enum { enabled = 1 }; };
+
+	// Whether the stages record how long they took, see
+	// Model::setStageTiming
+	struct NoInstrumentation { enum { enabled = 0 }; };
+	struct StageTiming { enum { enabled = 1 }; };
+}
+
+#endif
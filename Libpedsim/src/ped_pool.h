@@ -0,0 +1,96 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Tpool is a monotonic arena for objects of one type. Objects are
+// constructed in large blocks, each twice the size of the previous
+// one, and are all destroyed and freed together by clear() or the
+// pool's destructor. There is no way to free a single object.
+//
+// The model keeps its agents and waypoints in pools, so setting up
+// a million agents takes a few dozen allocations instead of a
+// million, and agents created together lie next to each other in
+// memory.
+//
+#ifndef _ped_pool_h_
+#define _ped_pool_h_ 1
+
+#include <vector>
+#include <new>
+#include <utility>
+#include <cstddef>
+#include <algorithm>
+
+namespace Ped {
+	template<typename T>
+	class Tpool {
+	public:
+		Tpool() : used(0) {}
+		~Tpool() { clear(); }
+
+		// Constructs a new object in the pool
+		template<typename... Args>
+		T *create(Args&&... args) {
+			if (blocks.empty() || used == blockSizes.back()) {
+				grow();
+			}
+			T *object = new (blocks.back() + used) T(std::forward<Args>(args)...);
+			used++;
+			return object;
+		}
+
+		// Makes sure the next n objects fit in the current block
+		void reserve(size_t n) {
+			if (n > 0 && (blocks.empty() || blockSizes.back() - used < n)) {
+				addBlock(n);
+			}
+		}
+
+		// Destroys all objects and frees all blocks
+		void clear() {
+			for (size_t b = 0; b < blocks.size(); b++) {
+				const size_t constructed = (b + 1 == blocks.size()) ? used : blockSizes[b];
+				for (size_t i = 0; i < constructed; i++) {
+					blocks[b][i].~T();
+				}
+				::operator delete(blocks[b]);
+			}
+			blocks.clear();
+			blockSizes.clear();
+			used = 0;
+		}
+
+	private:
+		// Pools own their objects and cannot be copied
+		Tpool(const Tpool&) = delete;
+		Tpool &operator=(const Tpool&) = delete;
+
+		static const size_t FIRST_BLOCK = 256;
+
+		void grow() {
+			addBlock(blocks.empty() ? FIRST_BLOCK : std::max<size_t>(blockSizes.back() * 2, FIRST_BLOCK));
+		}
+
+		// Starts a new block. The rest of the current one stays unused.
+		void addBlock(size_t size) {
+			if (!blocks.empty()) {
+				// Only the last block may be partially constructed
+				blockSizes.back() = used;
+			}
+			blocks.push_back(static_cast<T*>(::operator new(size * sizeof(T))));
+			blockSizes.push_back(size);
+			used = 0;
+		}
+
+		std::vector<T*> blocks;
+		std::vector<size_t> blockSizes;
+
+		// Number of objects constructed in the last block
+		size_t used;
+	};
+
+	// std::max takes FIRST_BLOCK by reference, which needs a definition
+	template<typename T>
+	const size_t Tpool<T>::FIRST_BLOCK;
+}
+
+#endif
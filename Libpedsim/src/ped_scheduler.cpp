@@ -0,0 +1,170 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Implements the work-stealing task scheduler.
+//
+#include "ped_scheduler.h"
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+Ped::Tscheduler::Tscheduler(int requestedThreads) : generation(0), stopping(false),
+	successorStart(NULL), successors(NULL), function(NULL), context(NULL), pendingCapacity(0), remaining(0), busyWorkers(0)
+{
+	numThreads = requestedThreads > 0 ? requestedThreads : static_cast<int>(std::thread::hardware_concurrency());
+	if (numThreads < 1) {
+		numThreads = 1;
+	}
+
+	for (int i = 0; i < numThreads; i++) {
+		workers.push_back(std::unique_ptr<Worker>(new Worker()));
+		workers[i]->front = 0;
+		workers[i]->size = 0;
+	}
+
+	// Worker 0 is the thread that calls run()
+	for (int i = 1; i < numThreads; i++) {
+		threads.push_back(std::thread(&Tscheduler::workerLoop, this, i));
+	}
+}
+
+Ped::Tscheduler::~Tscheduler()
+{
+	{
+		std::lock_guard<std::mutex> guard(runLock);
+		stopping = true;
+	}
+	runStarted.notify_all();
+	for (size_t i = 0; i < threads.size(); i++) {
+		threads[i].join();
+	}
+}
+
+void Ped::Tscheduler::runGraph(int numTasks, const int *dependencies, const int *graphSuccessorStart, const int *graphSuccessors, TaskFunction taskFunction, void *taskContext)
+{
+	if (numTasks <= 0) {
+		return;
+	}
+
+	// Buffers only grow, so running the same graph again never allocates
+	if (numTasks > pendingCapacity) {
+		pending.reset(new std::atomic<int>[numTasks]);
+		pendingCapacity = numTasks;
+		for (int i = 0; i < numThreads; i++) {
+			workers[i]->ring.resize(numTasks);
+		}
+	}
+	for (int i = 0; i < numThreads; i++) {
+		workers[i]->front = 0;
+		workers[i]->size = 0;
+	}
+
+	successorStart = graphSuccessorStart;
+	successors = graphSuccessors;
+	function = taskFunction;
+	context = taskContext;
+	remaining = numTasks;
+
+	// Deal the tasks that can start right away round-robin over the workers
+	int next = 0;
+	for (int i = 0; i < numTasks; i++) {
+		pending[i] = dependencies[i];
+		if (dependencies[i] == 0) {
+			push(next, i);
+			next = (next + 1) % numThreads;
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard(runLock);
+		busyWorkers = numThreads;
+		generation++;
+	}
+	runStarted.notify_all();
+
+	work(0);
+
+	// Don't let the next run reset the graph while a worker still reads it
+	while (busyWorkers > 0) {
+		std::this_thread::yield();
+	}
+}
+
+void Ped::Tscheduler::workerLoop(int worker)
+{
+	unsigned int seen = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(runLock);
+			runStarted.wait(guard, [&] { return stopping || generation != seen; });
+			if (stopping) {
+				return;
+			}
+			seen = generation;
+		}
+		work(worker);
+	}
+}
+
+void Ped::Tscheduler::work(int worker)
+{
+	int task;
+	while (remaining > 0) {
+		if (!pop(worker, task) && !steal(worker, task)) {
+			std::this_thread::yield();
+			continue;
+		}
+
+		function(context, task);
+
+		// Queue the successors this task was the last dependency of
+		for (int s = successorStart[task]; s < successorStart[task + 1]; s++) {
+			if (--pending[successors[s]] == 0) {
+				push(worker, successors[s]);
+			}
+		}
+		remaining--;
+	}
+	busyWorkers--;
+}
+
+void Ped::Tscheduler::push(int worker, int task)
+{
+	Worker &w = *workers[worker];
+	std::lock_guard<std::mutex> guard(w.lock);
+	w.ring[(w.front + w.size) % w.ring.size()] = task;
+	w.size++;
+}
+
+bool Ped::Tscheduler::pop(int worker, int &task)
+{
+	Worker &w = *workers[worker];
+	std::lock_guard<std::mutex> guard(w.lock);
+	if (w.size == 0) {
+		return false;
+	}
+	w.size--;
+	task = w.ring[(w.front + w.size) % w.ring.size()];
+	return true;
+}
+
+bool Ped::Tscheduler::steal(int thief, int &task)
+{
+	for (int i = 1; i < numThreads; i++) {
+		Worker &w = *workers[(thief + i) % numThreads];
+		std::lock_guard<std::mutex> guard(w.lock);
+		if (w.size == 0) {
+			continue;
+		}
+		task = w.ring[w.front];
+		w.front = (w.front + 1) % w.ring.size();
+		w.size--;
+		return true;
+	}
+	return false;
+}
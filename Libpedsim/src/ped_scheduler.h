@@ -0,0 +1,101 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Tscheduler runs a graph of small tasks on a pool of threads with
+// work stealing. Every worker owns a queue; it runs its own newest
+// task first and, when its queue is empty, steals the oldest task of
+// another worker. A task becomes ready once all of its predecessors
+// have finished, and is then queued by the worker that finished the
+// last of them.
+//
+// MSVC only implements OpenMP 2.0, which has no tasks, hence the
+// hand-written scheduler.
+//
+#ifndef _ped_scheduler_h_
+#define _ped_scheduler_h_ 1
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+
+namespace Ped {
+	class Tscheduler {
+	public:
+		// Starts numThreads - 1 worker threads; the thread calling run()
+		// is the last worker. 0 means one thread per hardware thread.
+		explicit Tscheduler(int numThreads = 0);
+		~Tscheduler();
+
+		int getNumThreads() const { return numThreads; };
+
+		// Runs body(i) for every task i in [0, numTasks) and returns once
+		// all of them have finished. Task i waits for dependencies[i]
+		// other tasks; when it finishes, the tasks
+		// successors[successorStart[i]] .. successors[successorStart[i + 1] - 1]
+		// each have one dependency less. The graph must be acyclic.
+		template<typename Body>
+		void run(int numTasks, const int *dependencies, const int *successorStart, const int *successors, Body &body) {
+			runGraph(numTasks, dependencies, successorStart, successors, &callBody<Body>, &body);
+		}
+
+	private:
+		Tscheduler(const Tscheduler&) = delete;
+		Tscheduler &operator=(const Tscheduler&) = delete;
+
+		typedef void(*TaskFunction)(void *context, int task);
+
+		template<typename Body>
+		static void callBody(void *context, int task) {
+			(*static_cast<Body*>(context))(task);
+		}
+
+		// A worker's queue: a ring buffer with room for every task of
+		// the graph, so queuing never allocates. The owner pushes and
+		// pops at the back, thieves take from the front.
+		struct Worker {
+			std::mutex lock;
+			std::vector<int> ring;
+			int front;
+			int size;
+		};
+
+		void runGraph(int numTasks, const int *dependencies, const int *successorStart, const int *successors, TaskFunction function, void *context);
+
+		// Body of the worker threads
+		void workerLoop(int worker);
+
+		// Runs and steals tasks until the whole graph is done
+		void work(int worker);
+
+		void push(int worker, int task);
+		bool pop(int worker, int &task);
+		bool steal(int thief, int &task);
+
+		int numThreads;
+		std::vector<std::thread> threads;
+		std::vector<std::unique_ptr<Worker> > workers;
+
+		// Wakes the workers for a new run
+		std::mutex runLock;
+		std::condition_variable runStarted;
+		unsigned int generation;
+		bool stopping;
+
+		// The graph being run
+		const int *successorStart;
+		const int *successors;
+		TaskFunction function;
+		void *context;
+		std::unique_ptr<std::atomic<int>[]> pending;
+		int pendingCapacity;
+		std::atomic<int> remaining;
+
+		// Workers still inside work() for the current run
+		std::atomic<int> busyWorkers;
+	};
+}
+
+#endif
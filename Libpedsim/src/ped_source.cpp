@@ -0,0 +1,20 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+#include "ped_source.h"
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+Ped::Tsource::Tsource(double x, double y, double dx, double dy, double rate, int max) : x(x), y(y), dx(dx), dy(dy), rate(rate), max(max)
+{
+}
+
+Ped::Tsink::Tsink(double x, double y, double r) : x(x), y(y), r(r)
+{
+}
@@ -0,0 +1,69 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Tsource is an entrance: it puts new agents into a rectangular
+// area at a given rate, each with the source's list of waypoints.
+// Tsink is an exit: agents that come within its radius leave the
+// simulation. Together they let crowds pass through a scenario
+// instead of circling through the same waypoints forever.
+//
+#ifndef _ped_source_h_
+#define _ped_source_h_ 1
+
+#include <vector>
+
+namespace Ped {
+	class Twaypoint;
+
+	class Tsource {
+	public:
+		// Agents appear in the dx * dy area centered at (x, y), rate
+		// agents per tick (may be fractional), with at most max agents
+		// from this source in the simulation at the same time.
+		Tsource(double x, double y, double dx, double dy, double rate, int max);
+
+		// Adds a waypoint every agent from this source will visit
+		void addWaypoint(Twaypoint *wp) { waypoints.push_back(wp); };
+
+		double getx() const { return x; };
+		double gety() const { return y; };
+		double getdx() const { return dx; };
+		double getdy() const { return dy; };
+		double getRate() const { return rate; };
+		int getMax() const { return max; };
+		const std::vector<Twaypoint*> &getWaypoints() const { return waypoints; };
+
+	private:
+		double x;
+		double y;
+		double dx;
+		double dy;
+		double rate;
+		int max;
+
+		std::vector<Twaypoint*> waypoints;
+	};
+
+	class Tsink {
+	public:
+		Tsink(double x, double y, double r);
+
+		// True if an agent at (px, py) is inside this sink
+		bool contains(int px, int py) const {
+			double diffX = px - x;
+			double diffY = py - y;
+			return diffX * diffX + diffY * diffY < r * r;
+		}
+
+		double getx() const { return x; };
+		double gety() const { return y; };
+		double getr() const { return r; };
+
+	private:
+		double x;
+		double y;
+		double r;
+	};
+}
+
+#endif
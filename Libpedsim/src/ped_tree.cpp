@@ -0,0 +1,301 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Implements the quadtree the model files its agents in.
+//
+#include "ped_tree.h"
+
+#include <algorithm>
+#include <queue>
+
+// Memory leak check with msvc++
+#define _CRTDBG_MAP_ALLOC
+#include <stdlib.h>
+#include <crtdbg.h>
+#ifdef _DEBUG
+#define new new(_NORMAL_BLOCK, __FILE__, __LINE__)
+#endif
+
+Ped::Ttree::Ttree(int size) : rootSize(1)
+{
+	// Power of two sides halve evenly down to single cells
+	while (rootSize < size) {
+		rootSize *= 2;
+	}
+	clear();
+}
+
+void Ped::Ttree::clear()
+{
+	if (nodes.empty()) {
+		nodes.resize(1);
+		nodes[0].entries.reserve(LEAF_CAPACITY + 1);
+	}
+	Node &root = nodes[0];
+	root.x = 0;
+	root.y = 0;
+	root.size = rootSize;
+	root.children = -1;
+	root.parent = -1;
+	root.count = 0;
+	root.entries.clear();
+
+	// The other nodes are kept, with the room their leaves grew, for
+	// the splits that rebuild the tree
+	freeGroups.clear();
+	for (size_t first = 1; first < nodes.size(); first += 4) {
+		for (int i = 0; i < 4; i++) {
+			Node &node = nodes[first + i];
+			node.children = -1;
+			node.count = 0;
+			node.size = 0;
+			node.entries.clear();
+		}
+		freeGroups.push_back(static_cast<int>(first));
+	}
+}
+
+int Ped::Ttree::childAt(const Node &node, int x, int y) const
+{
+	const int half = node.size / 2;
+	return node.children + (x >= node.x + half ? 1 : 0) + (y >= node.y + half ? 2 : 0);
+}
+
+void Ped::Ttree::insert(const Tagent *agent)
+{
+	const Entry entry = { agent, clampCell(agent->getX()), clampCell(agent->getY()) };
+	insertEntry(entry);
+}
+
+void Ped::Ttree::insertEntry(const Entry &entry)
+{
+	int node = 0;
+	while (nodes[node].children != -1) {
+		nodes[node].count++;
+		node = childAt(nodes[node], entry.x, entry.y);
+	}
+	nodes[node].count++;
+	nodes[node].entries.push_back(entry);
+	if (nodes[node].entries.size() > LEAF_CAPACITY && nodes[node].size > 1) {
+		split(node);
+	}
+}
+
+void Ped::Ttree::split(int node)
+{
+	// Reusing a merged group keeps the capacity its leaves grew
+	int first;
+	if (!freeGroups.empty()) {
+		first = freeGroups.back();
+		freeGroups.pop_back();
+	}
+	else {
+		// A leaf takes one entry over its capacity before it splits
+		first = static_cast<int>(nodes.size());
+		nodes.resize(nodes.size() + 4);
+		for (int i = 0; i < 4; i++) {
+			nodes[first + i].entries.reserve(LEAF_CAPACITY + 1);
+		}
+	}
+
+	// Only now, as growing the pool moves the nodes
+	Node &parent = nodes[node];
+	const int half = parent.size / 2;
+	for (int i = 0; i < 4; i++) {
+		Node &child = nodes[first + i];
+		child.x = parent.x + (i & 1 ? half : 0);
+		child.y = parent.y + (i & 2 ? half : 0);
+		child.size = half;
+		child.children = -1;
+		child.parent = node;
+		child.count = 0;
+		child.entries.clear();
+	}
+	parent.children = first;
+	for (size_t i = 0; i < parent.entries.size(); i++) {
+		Node &child = nodes[childAt(parent, parent.entries[i].x, parent.entries[i].y)];
+		child.entries.push_back(parent.entries[i]);
+		child.count++;
+	}
+	parent.entries.clear();
+
+	// All of them may have landed in the same quarter
+	for (int i = 0; i < 4; i++) {
+		if (nodes[first + i].entries.size() > LEAF_CAPACITY && half > 1) {
+			split(first + i);
+		}
+	}
+}
+
+void Ped::Ttree::merge(int node)
+{
+	const int first = nodes[node].children;
+	for (int i = 0; i < 4; i++) {
+		collect(first + i, nodes[node].entries);
+	}
+	release(first);
+	nodes[node].children = -1;
+}
+
+void Ped::Ttree::collect(int node, std::vector<Entry> &into)
+{
+	if (nodes[node].children == -1) {
+		into.insert(into.end(), nodes[node].entries.begin(), nodes[node].entries.end());
+		nodes[node].entries.clear();
+		return;
+	}
+	for (int i = 0; i < 4; i++) {
+		collect(nodes[node].children + i, into);
+	}
+}
+
+void Ped::Ttree::release(int first)
+{
+	for (int i = 0; i < 4; i++) {
+		Node &child = nodes[first + i];
+		if (child.children != -1) {
+			release(child.children);
+		}
+		child.children = -1;
+		child.count = 0;
+
+		// Marks the node as unused for update()
+		child.size = 0;
+	}
+	freeGroups.push_back(first);
+}
+
+void Ped::Ttree::remove(const Tagent *agent)
+{
+	if (!removeFrom(0, agent, clampCell(agent->getX()), clampCell(agent->getY()), false)) {
+		removeFrom(0, agent, 0, 0, true);
+	}
+}
+
+bool Ped::Ttree::removeFrom(int node, const Tagent *agent, int x, int y, bool anywhere)
+{
+	Node &current = nodes[node];
+	if (current.children == -1) {
+		for (size_t i = 0; i < current.entries.size(); i++) {
+			if (current.entries[i].agent == agent) {
+				current.entries[i] = current.entries.back();
+				current.entries.pop_back();
+				current.count--;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool removed = false;
+	if (anywhere) {
+		for (int i = 0; i < 4 && !removed; i++) {
+			removed = removeFrom(current.children + i, agent, x, y, true);
+		}
+	}
+	else {
+		removed = removeFrom(childAt(current, x, y), agent, x, y, false);
+	}
+
+	if (removed) {
+		current.count--;
+	}
+	return removed;
+}
+
+void Ped::Ttree::update()
+{
+	// Agents still inside their leaf are refiled where they stand, the
+	// others are taken out and inserted again from the root
+	moved.clear();
+	for (size_t n = 0; n < nodes.size(); n++) {
+		Node &node = nodes[n];
+		if (node.size == 0 || node.children != -1) {
+			continue;
+		}
+		size_t kept = 0;
+		for (size_t i = 0; i < node.entries.size(); i++) {
+			Entry entry = node.entries[i];
+			entry.x = clampCell(entry.agent->getX());
+			entry.y = clampCell(entry.agent->getY());
+			if (entry.x >= node.x && entry.x < node.x + node.size && entry.y >= node.y && entry.y < node.y + node.size) {
+				node.entries[kept++] = entry;
+				continue;
+			}
+			moved.push_back(entry);
+			for (int ancestor = static_cast<int>(n); ancestor != -1; ancestor = nodes[ancestor].parent) {
+				nodes[ancestor].count--;
+			}
+		}
+		node.entries.resize(kept);
+	}
+	for (size_t i = 0; i < moved.size(); i++) {
+		insertEntry(moved[i]);
+	}
+
+	// Inserting split the leaves that overflowed; what emptied merges
+	rebalance(0);
+}
+
+void Ped::Ttree::rebalance(int node)
+{
+	if (nodes[node].children == -1) {
+		return;
+	}
+	if (nodes[node].count <= LEAF_CAPACITY / 2) {
+		merge(node);
+		return;
+	}
+	for (int i = 0; i < 4; i++) {
+		rebalance(nodes[node].children + i);
+	}
+}
+
+void Ped::Ttree::nearest(int x, int y, int k, std::vector<const Tagent*> &out) const
+{
+	out.clear();
+	if (k <= 0) {
+		return;
+	}
+
+	// Best first: a node's distance is that of its nearest cell, widened
+	// by the margin, so no agent in it can be nearer than the node
+	struct Candidate {
+		long distance;
+		int node;
+		const Tagent *agent;
+		bool operator>(const Candidate &other) const { return distance > other.distance; }
+	};
+	std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate> > queue;
+	const Candidate root = { 0, 0, NULL };
+	queue.push(root);
+	while (!queue.empty() && static_cast<int>(out.size()) < k) {
+		const Candidate candidate = queue.top();
+		queue.pop();
+		if (candidate.agent != NULL) {
+			out.push_back(candidate.agent);
+			continue;
+		}
+
+		const Node &node = nodes[candidate.node];
+		if (node.count == 0) {
+			continue;
+		}
+		if (node.children == -1) {
+			for (size_t i = 0; i < node.entries.size(); i++) {
+				const long dx = node.entries[i].agent->getX() - x;
+				const long dy = node.entries[i].agent->getY() - y;
+				const Candidate agent = { dx * dx + dy * dy, -1, node.entries[i].agent };
+				queue.push(agent);
+			}
+			continue;
+		}
+		for (int i = 0; i < 4; i++) {
+			const Node &child = nodes[node.children + i];
+			const long dx = std::max(0L, std::max((long)child.x - MARGIN - x, (long)x - (child.x + child.size - 1 + MARGIN)));
+			const long dy = std::max(0L, std::max((long)child.y - MARGIN - y, (long)y - (child.y + child.size - 1 + MARGIN)));
+			const Candidate next = { dx * dx + dy * dy, node.children + i, NULL };
+			queue.push(next);
+		}
+	}
+}
@@ -0,0 +1,142 @@
+//
+// Created for Low Level Parallel Programming 2017
+//
+// Ttree is a quadtree over the cells of the world that the model
+// files its agents in, so that a neighbor search only looks at the
+// agents near the searched cell. A leaf holds up to LEAF_CAPACITY
+// agents and splits into four once it holds more; a node whose
+// subtree holds no more than half a leaf merges back into a leaf.
+// Crowded areas thus get deep, small leaves and empty ones a few
+// large leaves, so a search reads about the same number of agents
+// however unevenly the crowd is spread.
+//
+// An agent is filed at the cell it stood on when it was inserted or
+// last updated. Searches read the agents' live positions and widen
+// every node by MARGIN cells, so they stay exact while the agents
+// take their one step of the tick; update() then refiles the agents
+// that moved. Searches may run concurrently with each other and with
+// the agents moving, but not with insert(), remove() or update().
+//
+#ifndef _ped_tree_h_
+#define _ped_tree_h_ 1
+
+#include <vector>
+
+#include "ped_agent.h"
+
+namespace Ped {
+	class Ttree {
+	public:
+		enum { LEAF_CAPACITY = 16, MARGIN = 1 };
+
+		// Covers the cells [0, size) x [0, size). Agents outside are
+		// filed at the nearest cell inside.
+		explicit Ttree(int size);
+
+		// Removes every agent
+		void clear();
+
+		// Files the agent at its current position
+		void insert(const Tagent *agent);
+
+		// Takes out an agent filed at its current position, i.e. one
+		// that has not moved since the last update()
+		void remove(const Tagent *agent);
+
+		// Refiles the agents that moved, then splits and merges nodes
+		// by how many agents they hold
+		void update();
+
+		// Calls visit(agent) for at least every agent within dist cells
+		// of (x, y) on both axes. The caller checks the exact distance.
+		template<typename Visitor>
+		void query(int x, int y, int dist, Visitor &visit) const {
+			const int left = clampCell(x - dist) - MARGIN;
+			const int right = clampCell(x + dist) + MARGIN;
+			const int top = clampCell(y - dist) - MARGIN;
+			const int bottom = clampCell(y + dist) + MARGIN;
+
+			// Every node pushes at most four children, one level down
+			int stack[4 * 32];
+			int depth = 0;
+			stack[depth++] = 0;
+			while (depth > 0) {
+				const Node &node = nodes[stack[--depth]];
+				if (node.count == 0 || node.x > right || node.x + node.size <= left || node.y > bottom || node.y + node.size <= top) {
+					continue;
+				}
+				if (node.children == -1) {
+					for (size_t i = 0; i < node.entries.size(); i++) {
+						visit(node.entries[i].agent);
+					}
+					continue;
+				}
+				for (int child = 0; child < 4; child++) {
+					stack[depth++] = node.children + child;
+				}
+			}
+		}
+
+		// Writes the k agents nearest to (x, y), nearest first, into out.
+		// An agent standing at (x, y) is one of them.
+		void nearest(int x, int y, int k, std::vector<const Tagent*> &out) const;
+
+		// Number of agents filed
+		int size() const { return nodes[0].count; };
+
+	private:
+		struct Entry {
+			const Tagent *agent;
+			int x;
+			int y;
+		};
+
+		struct Node {
+			// The cells [x, x + size) x [y, y + size)
+			int x;
+			int y;
+			int size;
+
+			// Index of the first of the four children, -1 for a leaf, and
+			// of the parent, -1 for the root
+			int children;
+			int parent;
+
+			// Agents in the subtree; only leaves keep entries
+			int count;
+			std::vector<Entry> entries;
+		};
+
+		int clampCell(int value) const { return value < 0 ? 0 : (value >= rootSize ? rootSize - 1 : value); };
+
+		// Index of node's child containing (x, y)
+		int childAt(const Node &node, int x, int y) const;
+
+		void insertEntry(const Entry &entry);
+		void split(int node);
+
+		// Turns the node back into a leaf holding the entries of its subtree
+		void merge(int node);
+		void collect(int node, std::vector<Entry> &into);
+		void release(int node);
+
+		// Removes the agent from the subtree, looking everywhere if it is
+		// not where it should be filed
+		bool removeFrom(int node, const Tagent *agent, int x, int y, bool anywhere);
+
+		// Merges the nodes of the subtree that hold too few agents
+		void rebalance(int node);
+
+		int rootSize;
+
+		// nodes[0] is the root. Children come in groups of four; the
+		// groups of merged or cleared nodes are reused by the next splits.
+		std::vector<Node> nodes;
+		std::vector<int> freeGroups;
+
+		// Entries that left their leaf in update()
+		std::vector<Entry> moved;
+	};
+}
+
+#endif
@@ -27,7 +27,6 @@ namespace Ped {
 	public:
 		Twaypoint();
 		Twaypoint(double x, double y, double r);
-		virtual ~Twaypoint();
 
 		// Sets the coordinates and the radius of this waypoint
 		void setx(double px) { x = px; };